@@ -1,6 +1,33 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <sys/param.h> 
+#ifndef __linux__
 #include <sys/sysctl.h>
+#endif
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#if defined(__FreeBSD__)
+#include <sys/cpuset.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#if defined(__FreeBSD__) || defined(__DragonFly__)
+#include <sys/ioctl.h>
+#include <sys/cpuctl.h>
+#endif
+#if defined(__NetBSD__)
+#include <sched.h>
+#endif
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -8,13 +35,34 @@
 #include <string.h>
 #include <err.h>
 #include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#if defined(__linux__) || defined(__DragonFly__)
+#include <sched.h>
+#endif
 
 #if defined(__amd64__) || defined(__i386__)
 #include <cpuid.h>
 #endif
 
 /* macro definitions */
-#define CACHE_SIZE_LEN  (8)
+#define CACHE_SIZE_LEN  (16)
+#define X86_MAX_CACHES  (8)
+
+#define DUMP_VERSION    (1)
+
+#define BATCH_TEXT_LEN          (24 * 1024)
+#define BATCH_LINE_LEN          (4096)
+#define BATCH_NAME_LEN          (256)
+#define BATCH_SLOTS_PER_WORKER  (4)
+#define BATCH_HASH_SIZE         (1024) /* power of two */
+#define BATCH_MAX_FAMILY        (512)
+
+#define SNAPSHOT_MAGIC          (0x5550434C) /* "LCPU" */
+#define SNAPSHOT_VERSION        (9) /* bump whenever a snapshotted struct changes */
+#define SNAPSHOT_KEY_LEN        (64)
+#define SNAPSHOT_KERNEL_LEN     (320)
 
 #define ARRAY_LEN(array)    (sizeof(array) / sizeof(array[0]))
 
@@ -24,6 +72,8 @@
 #define CPUID_STANDARD_4_MASK   (0x04)
 #define CPUID_STANDARD_7_MASK   (0x07)
 #define CPUID_STANDARD_B_MASK   (0x0B)
+#define CPUID_STANDARD_D_MASK   (0x0D)
+#define CPUID_STANDARD_1F_MASK  (0x1F)
 
 
 #define CPUID_EXTENDED_1_MASK   (0x01)
@@ -31,11 +81,409 @@
 #define CPUID_EXTENDED_6_MASK   (0x06)
 #define CPUID_EXTENDED_8_MASK   (0x08)
 #define CPUID_EXTENDED_1E_MASK  (0x1E)
+#define CPUID_EXTENDED_1D_MASK  (0x1D)
 
 
 #define CPUID_MAX_STANDARD_FUNCTION (0x17)
 #define CPUID_MAX_EXTENDED_FUNCTION (0x1E)
 
+#define CPUID_CAPTURE_STANDARD_LIMIT    (0x3F)
+#define CPUID_CAPTURE_EXTENDED_LIMIT    (0x3F)
+#define CPUID_CAPTURE_HYPERVISOR_LIMIT  (0x1F)
+#define CPUID_MAX_SUBLEAVES             (32)
+#define CPUID_MAX_LEAVES                (256)
+
+#define CPUID_EAX   (0)
+#define CPUID_EBX   (1)
+#define CPUID_ECX   (2)
+#define CPUID_EDX   (3)
+
+#define X86_VENDOR_UNKNOWN  (0)
+#define X86_VENDOR_INTEL    (1)
+#define X86_VENDOR_AMD      (2)
+
+/* vendor masks used by X86_FEATURE_LIST */
+#define X86_VENDORS_ANY     (0xFF)
+#define X86_VENDORS_INTEL   (1 << X86_VENDOR_INTEL)
+#define X86_VENDORS_AMD     (1 << X86_VENDOR_AMD)
+
+/* XCR0 state components the OS must enable for a flag to be usable */
+#define X86_XSTATE_NONE     (0)
+#define X86_XSTATE_YMM      (0x6)       /* SSE, AVX */
+#define X86_XSTATE_ZMM      (0xE6)      /* plus opmask, ZMM_Hi256, Hi16_ZMM */
+#define X86_XSTATE_AMX      (0x60000)   /* XTILECFG, XTILEDATA */
+
+/*
+ * Every feature flag we decode: identifier, leaf, subleaf, register, bit,
+ * name, the vendors that define the bit and the XCR0 state it needs.
+ * Flags print in this order.
+ */
+#define X86_FEATURE_LIST \
+    X86_FEATURE(FPU,                 0x00000001, 0, EDX,  0, "fpu",                   ANY,  NONE) \
+    X86_FEATURE(VME,                 0x00000001, 0, EDX,  1, "vme",                   ANY,  NONE) \
+    X86_FEATURE(DE,                  0x00000001, 0, EDX,  2, "de",                    ANY,  NONE) \
+    X86_FEATURE(PSE,                 0x00000001, 0, EDX,  3, "pse",                   ANY,  NONE) \
+    X86_FEATURE(TSC,                 0x00000001, 0, EDX,  4, "tsc",                   ANY,  NONE) \
+    X86_FEATURE(MSR,                 0x00000001, 0, EDX,  5, "msr",                   ANY,  NONE) \
+    X86_FEATURE(PAE,                 0x00000001, 0, EDX,  6, "pae",                   ANY,  NONE) \
+    X86_FEATURE(MCE,                 0x00000001, 0, EDX,  7, "mce",                   ANY,  NONE) \
+    X86_FEATURE(CX8,                 0x00000001, 0, EDX,  8, "cx8",                   ANY,  NONE) \
+    X86_FEATURE(APIC,                0x00000001, 0, EDX,  9, "apic",                  ANY,  NONE) \
+    X86_FEATURE(SEP,                 0x00000001, 0, EDX, 11, "sep",                   ANY,  NONE) \
+    X86_FEATURE(MTRR,                0x00000001, 0, EDX, 12, "mtrr",                  ANY,  NONE) \
+    X86_FEATURE(PGE,                 0x00000001, 0, EDX, 13, "pge",                   ANY,  NONE) \
+    X86_FEATURE(MCA,                 0x00000001, 0, EDX, 14, "mca",                   ANY,  NONE) \
+    X86_FEATURE(CMOV,                0x00000001, 0, EDX, 15, "cmov",                  ANY,  NONE) \
+    X86_FEATURE(PAT,                 0x00000001, 0, EDX, 16, "pat",                   ANY,  NONE) \
+    X86_FEATURE(PSE36,               0x00000001, 0, EDX, 17, "pse36",                 ANY,  NONE) \
+    X86_FEATURE(PSN,                 0x00000001, 0, EDX, 18, "psn",                   ANY,  NONE) \
+    X86_FEATURE(CFLSH,               0x00000001, 0, EDX, 19, "cflsh",                 ANY,  NONE) \
+    X86_FEATURE(DS,                  0x00000001, 0, EDX, 21, "ds",                    ANY,  NONE) \
+    X86_FEATURE(ACPI,                0x00000001, 0, EDX, 22, "acpi",                  ANY,  NONE) \
+    X86_FEATURE(MMX,                 0x00000001, 0, EDX, 23, "mmx",                   ANY,  NONE) \
+    X86_FEATURE(FXSR,                0x00000001, 0, EDX, 24, "fxsr",                  ANY,  NONE) \
+    X86_FEATURE(SSE,                 0x00000001, 0, EDX, 25, "sse",                   ANY,  NONE) \
+    X86_FEATURE(SSE2,                0x00000001, 0, EDX, 26, "sse2",                  ANY,  NONE) \
+    X86_FEATURE(SS,                  0x00000001, 0, EDX, 27, "ss",                    ANY,  NONE) \
+    X86_FEATURE(HTT,                 0x00000001, 0, EDX, 28, "htt",                   ANY,  NONE) \
+    X86_FEATURE(TM,                  0x00000001, 0, EDX, 29, "tm",                    ANY,  NONE) \
+    X86_FEATURE(IA64,                0x00000001, 0, EDX, 30, "ia64",                  ANY,  NONE) \
+    X86_FEATURE(PBE,                 0x00000001, 0, EDX, 31, "pbe",                   ANY,  NONE) \
+    X86_FEATURE(SSE3,                0x00000001, 0, ECX,  0, "sse3",                  ANY,  NONE) \
+    X86_FEATURE(PCLMULQDQ,           0x00000001, 0, ECX,  1, "pclmulqdq",             ANY,  NONE) \
+    X86_FEATURE(DTES64,              0x00000001, 0, ECX,  2, "dtes64",                ANY,  NONE) \
+    X86_FEATURE(MONITOR,             0x00000001, 0, ECX,  3, "monitor",               ANY,  NONE) \
+    X86_FEATURE(DS_CPL,              0x00000001, 0, ECX,  4, "ds_cpl",                ANY,  NONE) \
+    X86_FEATURE(VMX,                 0x00000001, 0, ECX,  5, "vmx",                   ANY,  NONE) \
+    X86_FEATURE(SMX,                 0x00000001, 0, ECX,  6, "smx",                   ANY,  NONE) \
+    X86_FEATURE(EST,                 0x00000001, 0, ECX,  7, "est",                   ANY,  NONE) \
+    X86_FEATURE(TM2,                 0x00000001, 0, ECX,  8, "tm2",                   ANY,  NONE) \
+    X86_FEATURE(SSSE3,               0x00000001, 0, ECX,  9, "ssse3",                 ANY,  NONE) \
+    X86_FEATURE(CNXT_ID,             0x00000001, 0, ECX, 10, "cnxt-id",               ANY,  NONE) \
+    X86_FEATURE(SDBG,                0x00000001, 0, ECX, 11, "sdbg",                  ANY,  NONE) \
+    X86_FEATURE(FMA,                 0x00000001, 0, ECX, 12, "fma",                   ANY,  YMM) \
+    X86_FEATURE(CX16,                0x00000001, 0, ECX, 13, "cx16",                  ANY,  NONE) \
+    X86_FEATURE(XTPR,                0x00000001, 0, ECX, 14, "xtpr",                  ANY,  NONE) \
+    X86_FEATURE(PDCM,                0x00000001, 0, ECX, 15, "pdcm",                  ANY,  NONE) \
+    X86_FEATURE(PCID,                0x00000001, 0, ECX, 17, "pcid",                  ANY,  NONE) \
+    X86_FEATURE(DCA,                 0x00000001, 0, ECX, 18, "dca",                   ANY,  NONE) \
+    X86_FEATURE(SSE4_1,              0x00000001, 0, ECX, 19, "sse4_1",                ANY,  NONE) \
+    X86_FEATURE(SSE4_2,              0x00000001, 0, ECX, 20, "sse4_2",                ANY,  NONE) \
+    X86_FEATURE(X2APIC,              0x00000001, 0, ECX, 21, "x2apic",                ANY,  NONE) \
+    X86_FEATURE(MOVBE,               0x00000001, 0, ECX, 22, "movbe",                 ANY,  NONE) \
+    X86_FEATURE(POPCNT,              0x00000001, 0, ECX, 23, "popcnt",                ANY,  NONE) \
+    X86_FEATURE(TSC_DEADLINE,        0x00000001, 0, ECX, 24, "tsc_deadline",          ANY,  NONE) \
+    X86_FEATURE(AES,                 0x00000001, 0, ECX, 25, "aes",                   ANY,  NONE) \
+    X86_FEATURE(XSAVE,               0x00000001, 0, ECX, 26, "xsave",                 ANY,  NONE) \
+    X86_FEATURE(OSXSAVE,             0x00000001, 0, ECX, 27, "osxsave",               ANY,  NONE) \
+    X86_FEATURE(AVX,                 0x00000001, 0, ECX, 28, "avx",                   ANY,  YMM) \
+    X86_FEATURE(F16C,                0x00000001, 0, ECX, 29, "f16c",                  ANY,  YMM) \
+    X86_FEATURE(RDRND,               0x00000001, 0, ECX, 30, "rdrnd",                 ANY,  NONE) \
+    X86_FEATURE(HYPERVISOR,          0x00000001, 0, ECX, 31, "hypervisor",            ANY,  NONE) \
+    X86_FEATURE(DTHERM,              0x00000006, 0, EAX,  0, "dtherm",                ANY,  NONE) \
+    X86_FEATURE(IDA,                 0x00000006, 0, EAX,  1, "ida",                   ANY,  NONE) \
+    X86_FEATURE(ARAT,                0x00000006, 0, EAX,  2, "arat",                  ANY,  NONE) \
+    X86_FEATURE(PLN,                 0x00000006, 0, EAX,  4, "pln",                   ANY,  NONE) \
+    X86_FEATURE(PTS,                 0x00000006, 0, EAX,  6, "pts",                   ANY,  NONE) \
+    X86_FEATURE(HWP,                 0x00000006, 0, EAX,  7, "hwp",                   ANY,  NONE) \
+    X86_FEATURE(HWP_NOTIFY,          0x00000006, 0, EAX,  8, "hwp_notify",            ANY,  NONE) \
+    X86_FEATURE(HWP_ACT_WINDOW,      0x00000006, 0, EAX,  9, "hwp_act_window",        ANY,  NONE) \
+    X86_FEATURE(HWP_EPP,             0x00000006, 0, EAX, 10, "hwp_epp",               ANY,  NONE) \
+    X86_FEATURE(HWP_PKG_REQ,         0x00000006, 0, EAX, 11, "hwp_pkg_req",           ANY,  NONE) \
+    X86_FEATURE(HFI,                 0x00000006, 0, EAX, 19, "hfi",                   ANY,  NONE) \
+    X86_FEATURE(APERFMPERF,          0x00000006, 0, ECX,  0, "aperfmperf",            ANY,  NONE) \
+    X86_FEATURE(FSGSBASE,            0x00000007, 0, EBX,  0, "fsgsbase",              ANY,  NONE) \
+    X86_FEATURE(TSC_ADJUST,          0x00000007, 0, EBX,  1, "tsc_adjust",            ANY,  NONE) \
+    X86_FEATURE(SGX,                 0x00000007, 0, EBX,  2, "sgx",                   ANY,  NONE) \
+    X86_FEATURE(BMI1,                0x00000007, 0, EBX,  3, "bmi1",                  ANY,  NONE) \
+    X86_FEATURE(HLE,                 0x00000007, 0, EBX,  4, "hle",                   ANY,  NONE) \
+    X86_FEATURE(AVX2,                0x00000007, 0, EBX,  5, "avx2",                  ANY,  YMM) \
+    X86_FEATURE(FP_DP,               0x00000007, 0, EBX,  6, "fp_dp",                 ANY,  NONE) \
+    X86_FEATURE(SMEP,                0x00000007, 0, EBX,  7, "smep",                  ANY,  NONE) \
+    X86_FEATURE(BMI2,                0x00000007, 0, EBX,  8, "bmi2",                  ANY,  NONE) \
+    X86_FEATURE(ERMS,                0x00000007, 0, EBX,  9, "erms",                  ANY,  NONE) \
+    X86_FEATURE(INVPCID,             0x00000007, 0, EBX, 10, "invpcid",               ANY,  NONE) \
+    X86_FEATURE(RTM,                 0x00000007, 0, EBX, 11, "rtm",                   ANY,  NONE) \
+    X86_FEATURE(PQM,                 0x00000007, 0, EBX, 12, "pqm",                   ANY,  NONE) \
+    X86_FEATURE(FPCSDS,              0x00000007, 0, EBX, 13, "fpcsds",                ANY,  NONE) \
+    X86_FEATURE(MPX,                 0x00000007, 0, EBX, 14, "mpx",                   ANY,  NONE) \
+    X86_FEATURE(PQE,                 0x00000007, 0, EBX, 15, "pqe",                   ANY,  NONE) \
+    X86_FEATURE(AVX512F,             0x00000007, 0, EBX, 16, "avx512f",               ANY,  ZMM) \
+    X86_FEATURE(AVX512DQ,            0x00000007, 0, EBX, 17, "avx512dq",              ANY,  ZMM) \
+    X86_FEATURE(RDSEED,              0x00000007, 0, EBX, 18, "rdseed",                ANY,  NONE) \
+    X86_FEATURE(ADX,                 0x00000007, 0, EBX, 19, "adx",                   ANY,  NONE) \
+    X86_FEATURE(SMAP,                0x00000007, 0, EBX, 20, "smap",                  ANY,  NONE) \
+    X86_FEATURE(AVX512IFMA,          0x00000007, 0, EBX, 21, "avx512ifma",            ANY,  ZMM) \
+    X86_FEATURE(CLFLUSHOPT,          0x00000007, 0, EBX, 23, "clflushopt",            ANY,  NONE) \
+    X86_FEATURE(CLWB,                0x00000007, 0, EBX, 24, "clwb",                  ANY,  NONE) \
+    X86_FEATURE(INTEL_PT,            0x00000007, 0, EBX, 25, "intel_pt",              ANY,  NONE) \
+    X86_FEATURE(AVX512PF,            0x00000007, 0, EBX, 26, "avx512pf",              ANY,  ZMM) \
+    X86_FEATURE(AVX512ER,            0x00000007, 0, EBX, 27, "avx512er",              ANY,  ZMM) \
+    X86_FEATURE(AVX512CD,            0x00000007, 0, EBX, 28, "avx512cd",              ANY,  ZMM) \
+    X86_FEATURE(SHA,                 0x00000007, 0, EBX, 29, "sha",                   ANY,  NONE) \
+    X86_FEATURE(AVX512BW,            0x00000007, 0, EBX, 30, "avx512bw",              ANY,  ZMM) \
+    X86_FEATURE(AVX512VL,            0x00000007, 0, EBX, 31, "avx512vl",              ANY,  ZMM) \
+    X86_FEATURE(PREFETCHWT1,         0x00000007, 0, ECX,  0, "prefetchwt1",           ANY,  NONE) \
+    X86_FEATURE(AVX512VBMI,          0x00000007, 0, ECX,  1, "avx512vbmi",            ANY,  ZMM) \
+    X86_FEATURE(UMIP,                0x00000007, 0, ECX,  2, "umip",                  ANY,  NONE) \
+    X86_FEATURE(PKU,                 0x00000007, 0, ECX,  3, "pku",                   ANY,  NONE) \
+    X86_FEATURE(OSPKE,               0x00000007, 0, ECX,  4, "ospke",                 ANY,  NONE) \
+    X86_FEATURE(WAITPKG,             0x00000007, 0, ECX,  5, "waitpkg",               ANY,  NONE) \
+    X86_FEATURE(AVX512_VBMI2,        0x00000007, 0, ECX,  6, "avx512_vbmi2",          ANY,  ZMM) \
+    X86_FEATURE(SHSTK,               0x00000007, 0, ECX,  7, "shstk",                 ANY,  NONE) \
+    X86_FEATURE(GFNI,                0x00000007, 0, ECX,  8, "gfni",                  ANY,  NONE) \
+    X86_FEATURE(VAES,                0x00000007, 0, ECX,  9, "vaes",                  ANY,  YMM) \
+    X86_FEATURE(VPCLMULQDQ,          0x00000007, 0, ECX, 10, "vpclmulqdq",            ANY,  YMM) \
+    X86_FEATURE(AVX512_VNNI,         0x00000007, 0, ECX, 11, "avx512_vnni",           ANY,  ZMM) \
+    X86_FEATURE(AVX512_BITALG,       0x00000007, 0, ECX, 12, "avx512_bitalg",         ANY,  ZMM) \
+    X86_FEATURE(TME,                 0x00000007, 0, ECX, 13, "tme",                   ANY,  NONE) \
+    X86_FEATURE(AVX512_VPOPCNTDQ,    0x00000007, 0, ECX, 14, "avx512_vpopcntdq",      ANY,  ZMM) \
+    X86_FEATURE(LA57,                0x00000007, 0, ECX, 16, "la57",                  ANY,  NONE) \
+    X86_FEATURE(RDPID,               0x00000007, 0, ECX, 22, "rdpid",                 ANY,  NONE) \
+    X86_FEATURE(BUS_LOCK_DETECT,     0x00000007, 0, ECX, 24, "bus_lock_detect",       ANY,  NONE) \
+    X86_FEATURE(CLDEMOTE,            0x00000007, 0, ECX, 25, "cldemote",              ANY,  NONE) \
+    X86_FEATURE(MOVDIRI,             0x00000007, 0, ECX, 27, "movdiri",               ANY,  NONE) \
+    X86_FEATURE(MOVDIR64B,           0x00000007, 0, ECX, 28, "movdir64b",             ANY,  NONE) \
+    X86_FEATURE(ENQCMD,              0x00000007, 0, ECX, 29, "enqcmd",                ANY,  NONE) \
+    X86_FEATURE(SGX_LC,              0x00000007, 0, ECX, 30, "sgx_lc",                ANY,  NONE) \
+    X86_FEATURE(PKS,                 0x00000007, 0, ECX, 31, "pks",                   ANY,  NONE) \
+    X86_FEATURE(AVX512_4VNNIW,       0x00000007, 0, EDX,  2, "avx512_4vnniw",         ANY,  ZMM) \
+    X86_FEATURE(AVX512_4FMAPS,       0x00000007, 0, EDX,  3, "avx512_4fmaps",         ANY,  ZMM) \
+    X86_FEATURE(FSRM,                0x00000007, 0, EDX,  4, "fsrm",                  ANY,  NONE) \
+    X86_FEATURE(UINTR,               0x00000007, 0, EDX,  5, "uintr",                 ANY,  NONE) \
+    X86_FEATURE(AVX512_VP2INTERSECT, 0x00000007, 0, EDX,  8, "avx512_vp2intersect",   ANY,  ZMM) \
+    X86_FEATURE(SRBDS_CTRL,          0x00000007, 0, EDX,  9, "srbds_ctrl",            ANY,  NONE) \
+    X86_FEATURE(MD_CLEAR,            0x00000007, 0, EDX, 10, "md_clear",              ANY,  NONE) \
+    X86_FEATURE(RTM_ALWAYS_ABORT,    0x00000007, 0, EDX, 11, "rtm_always_abort",      ANY,  NONE) \
+    X86_FEATURE(TSX_FORCE_ABORT,     0x00000007, 0, EDX, 13, "tsx_force_abort",       ANY,  NONE) \
+    X86_FEATURE(SERIALIZE,           0x00000007, 0, EDX, 14, "serialize",             ANY,  NONE) \
+    X86_FEATURE(HYBRID_CPU,          0x00000007, 0, EDX, 15, "hybrid_cpu",            ANY,  NONE) \
+    X86_FEATURE(TSXLDTRK,            0x00000007, 0, EDX, 16, "tsxldtrk",              ANY,  NONE) \
+    X86_FEATURE(PCONFIG,             0x00000007, 0, EDX, 18, "pconfig",               ANY,  NONE) \
+    X86_FEATURE(ARCH_LBR,            0x00000007, 0, EDX, 19, "arch_lbr",              ANY,  NONE) \
+    X86_FEATURE(IBT,                 0x00000007, 0, EDX, 20, "ibt",                   ANY,  NONE) \
+    X86_FEATURE(AMX_BF16,            0x00000007, 0, EDX, 22, "amx_bf16",              ANY,  AMX) \
+    X86_FEATURE(AVX512_FP16,         0x00000007, 0, EDX, 23, "avx512_fp16",           ANY,  ZMM) \
+    X86_FEATURE(AMX_TILE,            0x00000007, 0, EDX, 24, "amx_tile",              ANY,  AMX) \
+    X86_FEATURE(AMX_INT8,            0x00000007, 0, EDX, 25, "amx_int8",              ANY,  AMX) \
+    X86_FEATURE(SPEC_CTRL,           0x00000007, 0, EDX, 26, "spec_ctrl",             ANY,  NONE) \
+    X86_FEATURE(INTEL_STIBP,         0x00000007, 0, EDX, 27, "intel_stibp",           ANY,  NONE) \
+    X86_FEATURE(FLUSH_L1D,           0x00000007, 0, EDX, 28, "flush_l1d",             ANY,  NONE) \
+    X86_FEATURE(ARCH_CAPABILITIES,   0x00000007, 0, EDX, 29, "arch_capabilities",     ANY,  NONE) \
+    X86_FEATURE(CORE_CAPABILITIES,   0x00000007, 0, EDX, 30, "core_capabilities",     ANY,  NONE) \
+    X86_FEATURE(SPEC_CTRL_SSBD,      0x00000007, 0, EDX, 31, "spec_ctrl_ssbd",        ANY,  NONE) \
+    X86_FEATURE(SHA512,              0x00000007, 1, EAX,  0, "sha512",                ANY,  NONE) \
+    X86_FEATURE(SM3,                 0x00000007, 1, EAX,  1, "sm3",                   ANY,  NONE) \
+    X86_FEATURE(SM4,                 0x00000007, 1, EAX,  2, "sm4",                   ANY,  NONE) \
+    X86_FEATURE(AVX_VNNI,            0x00000007, 1, EAX,  4, "avx_vnni",              ANY,  YMM) \
+    X86_FEATURE(AVX512_BF16,         0x00000007, 1, EAX,  5, "avx512_bf16",           ANY,  ZMM) \
+    X86_FEATURE(CMPCCXADD,           0x00000007, 1, EAX,  7, "cmpccxadd",             ANY,  NONE) \
+    X86_FEATURE(ARCH_PERFMON_EXT,    0x00000007, 1, EAX,  8, "arch_perfmon_ext",      ANY,  NONE) \
+    X86_FEATURE(FZRM,                0x00000007, 1, EAX, 10, "fzrm",                  ANY,  NONE) \
+    X86_FEATURE(FSRS,                0x00000007, 1, EAX, 11, "fsrs",                  ANY,  NONE) \
+    X86_FEATURE(FSRC,                0x00000007, 1, EAX, 12, "fsrc",                  ANY,  NONE) \
+    X86_FEATURE(FRED,                0x00000007, 1, EAX, 17, "fred",                  ANY,  NONE) \
+    X86_FEATURE(LKGS,                0x00000007, 1, EAX, 18, "lkgs",                  ANY,  NONE) \
+    X86_FEATURE(WRMSRNS,             0x00000007, 1, EAX, 19, "wrmsrns",               ANY,  NONE) \
+    X86_FEATURE(AMX_FP16,            0x00000007, 1, EAX, 21, "amx_fp16",              ANY,  AMX) \
+    X86_FEATURE(HRESET,              0x00000007, 1, EAX, 22, "hreset",                ANY,  NONE) \
+    X86_FEATURE(AVX_IFMA,            0x00000007, 1, EAX, 23, "avx_ifma",              ANY,  YMM) \
+    X86_FEATURE(LAM,                 0x00000007, 1, EAX, 26, "lam",                   ANY,  NONE) \
+    X86_FEATURE(AVX_VNNI_INT8,       0x00000007, 1, EDX,  4, "avx_vnni_int8",         ANY,  YMM) \
+    X86_FEATURE(AVX_NE_CONVERT,      0x00000007, 1, EDX,  5, "avx_ne_convert",        ANY,  YMM) \
+    X86_FEATURE(AMX_COMPLEX,         0x00000007, 1, EDX,  8, "amx_complex",           ANY,  AMX) \
+    X86_FEATURE(AVX_VNNI_INT16,      0x00000007, 1, EDX, 10, "avx_vnni_int16",        ANY,  YMM) \
+    X86_FEATURE(PREFETCHITI,         0x00000007, 1, EDX, 14, "prefetchiti",           ANY,  NONE) \
+    X86_FEATURE(AVX10,               0x00000007, 1, EDX, 19, "avx10",                 ANY,  ZMM) \
+    X86_FEATURE(XSAVEOPT,            0x0000000D, 1, EAX,  0, "xsaveopt",              ANY,  NONE) \
+    X86_FEATURE(XSAVEC,              0x0000000D, 1, EAX,  1, "xsavec",                ANY,  NONE) \
+    X86_FEATURE(XGETBV1,             0x0000000D, 1, EAX,  2, "xgetbv1",               ANY,  NONE) \
+    X86_FEATURE(XSAVES,              0x0000000D, 1, EAX,  3, "xsaves",                ANY,  NONE) \
+    X86_FEATURE(XFD,                 0x0000000D, 1, EAX,  4, "xfd",                   ANY,  NONE) \
+    X86_FEATURE(CQM_LLC,             0x0000000F, 0, EDX,  1, "cqm_llc",               ANY,  NONE) \
+    X86_FEATURE(CQM_OCCUP_LLC,       0x0000000F, 1, EDX,  0, "cqm_occup_llc",         ANY,  NONE) \
+    X86_FEATURE(CQM_MBM_TOTAL,       0x0000000F, 1, EDX,  1, "cqm_mbm_total",         ANY,  NONE) \
+    X86_FEATURE(CQM_MBM_LOCAL,       0x0000000F, 1, EDX,  2, "cqm_mbm_local",         ANY,  NONE) \
+    X86_FEATURE(SYSCALL,             0x80000001, 0, EDX, 11, "syscall",               ANY,  NONE) \
+    X86_FEATURE(MP,                  0x80000001, 0, EDX, 19, "mp",                    AMD,  NONE) \
+    X86_FEATURE(NX,                  0x80000001, 0, EDX, 20, "nx",                    ANY,  NONE) \
+    X86_FEATURE(MMXEXT,              0x80000001, 0, EDX, 22, "mmxext",                AMD,  NONE) \
+    X86_FEATURE(FXSR_OPT,            0x80000001, 0, EDX, 25, "fxsr_opt",              AMD,  NONE) \
+    X86_FEATURE(PDPE1GB,             0x80000001, 0, EDX, 26, "pdpe1gb",               ANY,  NONE) \
+    X86_FEATURE(RDTSCP,              0x80000001, 0, EDX, 27, "rdtscp",                ANY,  NONE) \
+    X86_FEATURE(LM,                  0x80000001, 0, EDX, 29, "lm",                    ANY,  NONE) \
+    X86_FEATURE(_3DNOWEXT,           0x80000001, 0, EDX, 30, "3dnowext",              AMD,  NONE) \
+    X86_FEATURE(_3DNOW,              0x80000001, 0, EDX, 31, "3dnow",                 AMD,  NONE) \
+    X86_FEATURE(LAHF_LM,             0x80000001, 0, ECX,  0, "lahf_lm",               ANY,  NONE) \
+    X86_FEATURE(CMP_LEGACY,          0x80000001, 0, ECX,  1, "cmp_legacy",            AMD,  NONE) \
+    X86_FEATURE(SVM,                 0x80000001, 0, ECX,  2, "svm",                   AMD,  NONE) \
+    X86_FEATURE(EXTAPIC,             0x80000001, 0, ECX,  3, "extapic",               AMD,  NONE) \
+    X86_FEATURE(CR8_LEGACY,          0x80000001, 0, ECX,  4, "cr8_legacy",            AMD,  NONE) \
+    X86_FEATURE(LZCNT,               0x80000001, 0, ECX,  5, "lzcnt",                 ANY,  NONE) \
+    X86_FEATURE(SSE4A,               0x80000001, 0, ECX,  6, "sse4a",                 AMD,  NONE) \
+    X86_FEATURE(MISALIGNSSE,         0x80000001, 0, ECX,  7, "misalignsse",           AMD,  NONE) \
+    X86_FEATURE(_3DNOWPREFETCH,      0x80000001, 0, ECX,  8, "3dnowprefetch",         ANY,  NONE) \
+    X86_FEATURE(OSVW,                0x80000001, 0, ECX,  9, "osvw",                  AMD,  NONE) \
+    X86_FEATURE(IBS,                 0x80000001, 0, ECX, 10, "ibs",                   AMD,  NONE) \
+    X86_FEATURE(XOP,                 0x80000001, 0, ECX, 11, "xop",                   AMD,  YMM) \
+    X86_FEATURE(SKINIT,              0x80000001, 0, ECX, 12, "skinit",                AMD,  NONE) \
+    X86_FEATURE(WDT,                 0x80000001, 0, ECX, 13, "wdt",                   AMD,  NONE) \
+    X86_FEATURE(LWP,                 0x80000001, 0, ECX, 15, "lwp",                   AMD,  NONE) \
+    X86_FEATURE(FMA4,                0x80000001, 0, ECX, 16, "fma4",                  AMD,  YMM) \
+    X86_FEATURE(TCE,                 0x80000001, 0, ECX, 17, "tce",                   AMD,  NONE) \
+    X86_FEATURE(NODEID_MSR,          0x80000001, 0, ECX, 19, "nodeid_msr",            AMD,  NONE) \
+    X86_FEATURE(TBM,                 0x80000001, 0, ECX, 21, "tbm",                   AMD,  NONE) \
+    X86_FEATURE(TOPOEXT,             0x80000001, 0, ECX, 22, "topoext",               AMD,  NONE) \
+    X86_FEATURE(PERFCTR_CORE,        0x80000001, 0, ECX, 23, "perfctr_core",          AMD,  NONE) \
+    X86_FEATURE(PERFCTR_NB,          0x80000001, 0, ECX, 24, "perfctr_nb",            AMD,  NONE) \
+    X86_FEATURE(DBX,                 0x80000001, 0, ECX, 26, "dbx",                   AMD,  NONE) \
+    X86_FEATURE(PERFTSC,             0x80000001, 0, ECX, 27, "perftsc",               AMD,  NONE) \
+    X86_FEATURE(PCX_L2I,             0x80000001, 0, ECX, 28, "pcx_l2i",               AMD,  NONE) \
+    X86_FEATURE(MWAITX,              0x80000001, 0, ECX, 29, "mwaitx",                AMD,  NONE) \
+    X86_FEATURE(HW_PSTATE,           0x80000007, 0, EDX,  7, "hw_pstate",             AMD,  NONE) \
+    X86_FEATURE(CONSTANT_TSC,        0x80000007, 0, EDX,  8, "constant_tsc",          ANY,  NONE) \
+    X86_FEATURE(NONSTOP_TSC,         0x80000007, 0, EDX,  8, "nonstop_tsc",           ANY,  NONE) \
+    X86_FEATURE(CPB,                 0x80000007, 0, EDX,  9, "cpb",                   AMD,  NONE) \
+    X86_FEATURE(PROC_FEEDBACK,       0x80000007, 0, EDX, 11, "proc_feedback",         AMD,  NONE) \
+    X86_FEATURE(CLZERO,              0x80000008, 0, EBX,  0, "clzero",                AMD,  NONE) \
+    X86_FEATURE(IRPERF,              0x80000008, 0, EBX,  1, "irperf",                AMD,  NONE) \
+    X86_FEATURE(XSAVEERPTR,          0x80000008, 0, EBX,  2, "xsaveerptr",            AMD,  NONE) \
+    X86_FEATURE(RDPRU,               0x80000008, 0, EBX,  4, "rdpru",                 AMD,  NONE) \
+    X86_FEATURE(WBNOINVD,            0x80000008, 0, EBX,  9, "wbnoinvd",              ANY,  NONE) \
+    X86_FEATURE(AMD_IBPB,            0x80000008, 0, EBX, 12, "amd_ibpb",              AMD,  NONE) \
+    X86_FEATURE(AMD_IBRS,            0x80000008, 0, EBX, 14, "amd_ibrs",              AMD,  NONE) \
+    X86_FEATURE(AMD_STIBP,           0x80000008, 0, EBX, 15, "amd_stibp",             AMD,  NONE) \
+    X86_FEATURE(AMD_STIBP_ALWAYS_ON, 0x80000008, 0, EBX, 17, "amd_stibp_always_on",   AMD,  NONE) \
+    X86_FEATURE(AMD_PPIN,            0x80000008, 0, EBX, 23, "amd_ppin",              AMD,  NONE) \
+    X86_FEATURE(AMD_SSBD,            0x80000008, 0, EBX, 24, "amd_ssbd",              AMD,  NONE) \
+    X86_FEATURE(VIRT_SSBD,           0x80000008, 0, EBX, 25, "virt_ssbd",             AMD,  NONE) \
+    X86_FEATURE(AMD_SSB_NO,          0x80000008, 0, EBX, 26, "amd_ssb_no",            AMD,  NONE) \
+    X86_FEATURE(CPPC,                0x80000008, 0, EBX, 27, "cppc",                  AMD,  NONE) \
+    X86_FEATURE(AMD_PSFD,            0x80000008, 0, EBX, 28, "amd_psfd",              AMD,  NONE) \
+    X86_FEATURE(BTC_NO,              0x80000008, 0, EBX, 29, "btc_no",                AMD,  NONE) \
+    X86_FEATURE(NPT,                 0x8000000A, 0, EDX,  0, "npt",                   AMD,  NONE) \
+    X86_FEATURE(LBRV,                0x8000000A, 0, EDX,  1, "lbrv",                  AMD,  NONE) \
+    X86_FEATURE(SVM_LOCK,            0x8000000A, 0, EDX,  2, "svm_lock",              AMD,  NONE) \
+    X86_FEATURE(NRIP_SAVE,           0x8000000A, 0, EDX,  3, "nrip_save",             AMD,  NONE) \
+    X86_FEATURE(TSC_SCALE,           0x8000000A, 0, EDX,  4, "tsc_scale",             AMD,  NONE) \
+    X86_FEATURE(VMCB_CLEAN,          0x8000000A, 0, EDX,  5, "vmcb_clean",            AMD,  NONE) \
+    X86_FEATURE(FLUSHBYASID,         0x8000000A, 0, EDX,  6, "flushbyasid",           AMD,  NONE) \
+    X86_FEATURE(DECODEASSISTS,       0x8000000A, 0, EDX,  7, "decodeassists",         AMD,  NONE) \
+    X86_FEATURE(PAUSEFILTER,         0x8000000A, 0, EDX, 10, "pausefilter",           AMD,  NONE) \
+    X86_FEATURE(PFTHRESHOLD,         0x8000000A, 0, EDX, 12, "pfthreshold",           AMD,  NONE) \
+    X86_FEATURE(AVIC,                0x8000000A, 0, EDX, 13, "avic",                  AMD,  NONE) \
+    X86_FEATURE(V_VMSAVE_VMLOAD,     0x8000000A, 0, EDX, 15, "v_vmsave_vmload",       AMD,  NONE) \
+    X86_FEATURE(VGIF,                0x8000000A, 0, EDX, 16, "vgif",                  AMD,  NONE) \
+    X86_FEATURE(X2AVIC,              0x8000000A, 0, EDX, 18, "x2avic",                AMD,  NONE) \
+    X86_FEATURE(V_SPEC_CTRL,         0x8000000A, 0, EDX, 20, "v_spec_ctrl",           AMD,  NONE) \
+    X86_FEATURE(VNMI,                0x8000000A, 0, EDX, 25, "vnmi",                  AMD,  NONE) \
+    X86_FEATURE(SME,                 0x8000001F, 0, EAX,  0, "sme",                   AMD,  NONE) \
+    X86_FEATURE(SEV,                 0x8000001F, 0, EAX,  1, "sev",                   AMD,  NONE) \
+    X86_FEATURE(SEV_ES,              0x8000001F, 0, EAX,  3, "sev_es",                AMD,  NONE) \
+    X86_FEATURE(SEV_SNP,             0x8000001F, 0, EAX,  4, "sev_snp",               AMD,  NONE)
+
+#define X86_FLAGS_LEN       (4096)
+#define X86_FEATURE_WORDS   ((X86_FEATURE_NUM + 31) / 32)
+#define X86_HAS_FEATURE(info, id)   (((info)->features[(id) / 32] >> ((id) % 32)) & 1)
+#define X86_FEATURE_HASH_SIZE   (512) /* power of two, about twice X86_FEATURE_NUM */
+
+#define CHECK_MAX_FEATURES  (64)
+
+#define XSAVE_LEGACY_SIZE   (512)   /* x87 and SSE state */
+#define XSAVE_HEADER_SIZE   (64)
+#define XSAVE_MAX_COMPONENTS    (63)
+
+#define PERCPU_FEATURE_WORDS    (5)
+#define PERCPU_STACK_SIZE       (64 * 1024)
+#define CPU_LIST_LEN            (4096)
+
+#define BENCH_HUGE_PAGE     (2 * 1024 * 1024)
+#define BENCH_MIN_SIZE      (64 * 1024 * 1024)
+#define BENCH_CHASE_LOADS   (1 << 19)
+#define BENCH_CHASE_RUNS    (3)
+#define BENCH_MAX_SIZES     (64)
+#define BENCH_KNEE_RATIO    (1.3)
+#define BENCH_REPEATS       (5)
+
+#define C2C_LINE_SIZE       (128) /* adjacent line prefetch pulls in pairs of 64 byte lines */
+#define C2C_SAMPLES         (50)
+#define C2C_ROUND_TRIPS     (100)
+
+#define TSC_SAMPLES         (1000)
+#define TSC_MEASURE_NSEC    (100 * 1000 * 1000)
+#define TSC_PROBE_READY     (0xFFFFFFFEU)
+#define TSC_PROBE_FAILED    (0xFFFFFFFFU)
+
+#define TIMING_MAX_PHASES   (32)
+
+#define VIRT_BATCH_OPS      (200)
+#define VIRT_BATCHES        (51)
+#define VIRT_FAULT_PAGES    (64)
+
+#define AFFINITY_MAX_CPUS   (1024) /* CPU_SETSIZE on Linux */
+#define NUMA_MAX_NODES      (64)
+#define NUMA_MPOL_BIND      (2) /* MPOL_BIND from <numaif.h>, which is in libnuma */
+
+#define MSR_IA32_MPERF          (0xE7)
+#define MSR_IA32_APERF          (0xE8)
+#define WATCH_LOOP_ADDS         (100) /* the .rept count in run_cycle_loop() */
+#define WATCH_LOOP_ITERATIONS   (1000)
+
+#define TURBO_KERNEL_ITERATIONS (1000)
+#define TURBO_WARMUP_NSEC       (100 * 1000 * 1000)
+#define TURBO_MEASURE_NSEC      (200 * 1000 * 1000)
+#define TURBO_REST_NSEC         (100 * 1000 * 1000)
+
+#define SIMD_KERNEL_ITERATIONS  (4000)
+#define SIMD_KERNEL_INSNS       (32) /* per iteration, 4 rounds of 8 chains */
+#define SIMD_REPEATS            (20)
+
+/*
+ * Throughput kernels: eight independent chains that each only depend on
+ * themselves, started from zero so no denormals show up.
+ */
+#define SIMD_CHAINS(op)     op(0) op(1) op(2) op(3) op(4) op(5) op(6) op(7)
+#define SIMD_SSE_ZERO(r)    "xorps %%xmm" #r ", %%xmm" #r "\n\t"
+#define SIMD_SSE_FP(r)      "mulps %%xmm" #r ", %%xmm" #r "\n\t"
+#define SIMD_SSE_INT(r)     "paddd %%xmm" #r ", %%xmm" #r "\n\t"
+#define SIMD_SSE_SHUF(r)    "pshufd $0x1b, %%xmm" #r ", %%xmm" #r "\n\t"
+#define SIMD_AVX2_ZERO(r)   "vpxor %%ymm" #r ", %%ymm" #r ", %%ymm" #r "\n\t"
+#define SIMD_AVX2_FP(r)     "vfmadd231ps %%ymm" #r ", %%ymm" #r ", %%ymm" #r "\n\t"
+#define SIMD_AVX2_INT(r)    "vpaddd %%ymm" #r ", %%ymm" #r ", %%ymm" #r "\n\t"
+#define SIMD_AVX2_SHUF(r)   "vpshufd $0x1b, %%ymm" #r ", %%ymm" #r "\n\t"
+#define SIMD_AVX512_ZERO(r) "vpxord %%zmm" #r ", %%zmm" #r ", %%zmm" #r "\n\t"
+#define SIMD_AVX512_FP(r)   "vfmadd231ps %%zmm" #r ", %%zmm" #r ", %%zmm" #r "\n\t"
+#define SIMD_AVX512_INT(r)  "vpaddd %%zmm" #r ", %%zmm" #r ", %%zmm" #r "\n\t"
+#define SIMD_AVX512_SHUF(r) "vpshufd $0x1b, %%zmm" #r ", %%zmm" #r "\n\t"
+#define SIMD_KERNEL(name, zero, op, leave) \
+    static void name(void) \
+    { \
+        __asm__ __volatile__( \
+            SIMD_CHAINS(zero) \
+            "mov %0, %%ecx\n\t" \
+            "1:\n\t" \
+            SIMD_CHAINS(op) SIMD_CHAINS(op) SIMD_CHAINS(op) SIMD_CHAINS(op) \
+            "dec %%ecx\n\t" \
+            "jnz 1b\n\t" \
+            leave \
+            : \
+            : "i"(SIMD_KERNEL_ITERATIONS) \
+            : "ecx", "cc", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7"); \
+        return; \
+    }
+
+#ifdef CLOCK_MONOTONIC_RAW
+#define TSC_REFERENCE_CLOCK CLOCK_MONOTONIC_RAW
+#else /* BSDs don't slew CLOCK_MONOTONIC */
+#define TSC_REFERENCE_CLOCK CLOCK_MONOTONIC
+#endif
+
+#if defined(__amd64__) || defined(__i386__)
+#define CPU_RELAX()         __builtin_ia32_pause()
+#else
+#define CPU_RELAX()         do { } while (0)
+#endif
+
 /* struct definitions */
 typedef struct
 {
@@ -45,6 +493,8 @@ typedef struct
     char vendor[32];
     int active_cpu_num;
     int total_cpu_num;
+    int possible_cpu_num; /* Linux only, includes hotpluggable slots */
+    int numa_node_num; /* 0 if the platform doesn't say */
     int speed;
 } gen_cpu_info;
 
@@ -54,57 +504,586 @@ typedef struct
     void *old;
     size_t old_len;
     char *err_msg;
+    int is_string;
 } sysctl_get_cpu_info;
 
+enum
+{
+#define X86_FEATURE(id, leaf, subleaf, reg, bit, name, vendors, xstate) X86_FEATURE_##id,
+    X86_FEATURE_LIST
+#undef X86_FEATURE
+    X86_FEATURE_NUM
+};
+
+typedef struct
+{
+    uint32_t leaf;
+    uint8_t subleaf;
+    uint8_t reg;
+    uint8_t bit;
+    uint8_t vendors;
+    uint32_t xstate;
+    const char *name;
+} x86_feature;
+
+typedef struct
+{
+    uint32_t leaf;
+    uint32_t subleaf;
+    uint32_t regs[4]; /* eax, ebx, ecx, edx */
+} cpuid_leaf;
+
+typedef struct
+{
+    int count;
+    uint32_t exec_count;
+    uint64_t exec_nsec;
+    uint64_t xcr0;
+    int xcr0_valid; /* 0 for dumps that predate it, nothing is masked then */
+    cpuid_leaf leaves[CPUID_MAX_LEAVES];
+} cpuid_table;
+
+typedef struct
+{
+    uint8_t level;
+    uint8_t type; /* 1 data, 2 instruction, 3 unified */
+    uint8_t fully_associative;
+    uint8_t inclusive;
+    uint16_t line_size;
+    uint16_t partitions;
+    uint16_t ways;
+    uint16_t sharing; /* maximum logical CPUs sharing it, 0 if unknown */
+    uint32_t sets;
+    uint64_t size; /* bytes */
+} x86_cache;
+
+typedef struct
+{
+    uint8_t smt_shift;
+    uint8_t core_shift;
+    uint8_t module_shift;
+    uint8_t die_shift;
+    uint8_t package_shift;
+} x86_topology;
+
 typedef struct
 {
     int standard_mask;
     int extended_mask;
-    int intel_use_leaf_4_get_cache;
+    int vendor_id;
     char vendor[13];
     unsigned char stepping;
     unsigned char model;
     unsigned short family;
     int threads_per_core;
     int cores_per_socket;
-    char *l1d_cache;
-    char *l1i_cache;
-    char *l2_cache;
-    char *l3_cache;
-    char flags[2048];
+    int sockets; /* counted from the OS topology, 0 if it doesn't say */
+    x86_topology topology;
+    char l1d_cache[CACHE_SIZE_LEN];
+    char l1i_cache[CACHE_SIZE_LEN];
+    char l2_cache[CACHE_SIZE_LEN];
+    char l3_cache[CACHE_SIZE_LEN];
+    int cache_num;
+    x86_cache caches[X86_MAX_CACHES];
+    uint32_t features[X86_FEATURE_WORDS]; /* bit i is x86_features[i] */
+    uint32_t disabled[X86_FEATURE_WORDS]; /* reported by CPUID, but the OS left its state off */
+    uint64_t xcr0;
+    int xcr0_valid;
+    int isa_level; /* x86-64 psABI level, 0 if not even the baseline */
 } x86_cpu_info;
 
+/* A platform backend fills the global gen_info for the running system */
+typedef struct
+{
+    const char *name;
+    int (*get_gen_info)(gen_cpu_info *gen_info);
+    int (*get_topology)(x86_cpu_info *x86_info); /* NULL if only a per-CPU sweep could tell */
+} platform_backend;
+
+typedef struct
+{
+    int cpu;
+    int valid;
+    uint32_t apic_id;
+    uint32_t x2apic_id;
+    uint32_t signature;
+    uint32_t hybrid_info;
+    uint32_t features[PERCPU_FEATURE_WORDS];
+    uint32_t amd_topology[4]; /* leaf 0x8000001E */
+    uint32_t package;
+    uint32_t die;
+    uint32_t module;
+    uint32_t core;
+    uint32_t smt;
+} percpu_info;
+
+typedef struct batch_slot
+{
+    struct batch_slot *next;
+    int is_file;
+    char name[BATCH_NAME_LEN];
+    size_t len;
+    char text[BATCH_TEXT_LEN];
+    cpuid_table table;
+    x86_cpu_info info;
+    char line[BATCH_LINE_LEN];
+} batch_slot;
+
+typedef struct
+{
+    uint32_t key; /* vendor_id << 24 | family << 8 | model, or a feature */
+    unsigned long count;
+} batch_count;
+
+typedef struct
+{
+    unsigned long records;
+    unsigned long failed;
+    unsigned long overflow;
+    unsigned long families[BATCH_MAX_FAMILY];
+    batch_count models[BATCH_HASH_SIZE];
+    unsigned long features[X86_FEATURE_NUM];
+} batch_stats;
+
+struct batch_pool;
+
+typedef struct
+{
+    int id;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    int head;
+    int count;
+    batch_slot **queue; /* ring deque, holds every slot at worst */
+    batch_stats stats;
+    struct batch_pool *pool;
+} batch_worker;
+
+typedef struct batch_pool
+{
+    int worker_num;
+    int slot_num;
+    int next_worker;
+    batch_worker *workers;
+    batch_slot *slots;
+    batch_slot *free_list;
+    pthread_mutex_t lock;
+    pthread_cond_t slot_cond;
+    pthread_cond_t work_cond;
+    int queued;
+    int done;
+} batch_pool;
+
+enum
+{
+    BENCH_READ,
+    BENCH_WRITE,
+    BENCH_COPY,
+    BENCH_KERNELS
+};
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int total;
+    int count;
+    unsigned long generation;
+} cpu_barrier;
+
+typedef struct
+{
+    pthread_t thread;
+    int cpu;
+    int pinned;
+    int huge;
+    size_t size;
+    cpu_barrier *barrier;
+    uint64_t nsec[BENCH_KERNELS][BENCH_REPEATS];
+    uint64_t sink;
+} bandwidth_thread;
+
+typedef struct
+{
+    atomic_uint flag;
+    char pad[C2C_LINE_SIZE - sizeof(atomic_uint)];
+} c2c_line;
+
+typedef struct
+{
+    pthread_t thread;
+    int cpu;
+    int index; /* position in the schedule and the matrix, not the CPU ID */
+    int cpu_num;
+    int pinned;
+    cpu_barrier *barrier;
+    c2c_line *lines;
+    double *matrix;
+} c2c_thread;
+
+typedef struct
+{
+    c2c_line line;
+    int cpu;
+    uint64_t remote[TSC_SAMPLES];
+} tsc_probe;
+
+typedef struct
+{
+    const int *cpus; /* cpus[0] is the reference */
+    int cpu_num;
+    int invariant;
+    double nominal_hz;
+} tsc_measure;
+
+typedef struct
+{
+    pthread_t thread;
+    int cpu;
+    int fd;
+    int pinned;
+    uint64_t aperf;
+    uint64_t mperf;
+    uint64_t loop_ticks;
+    cpu_barrier *barrier;
+    int *stop;
+} watch_cpu;
+
+enum
+{
+    TURBO_SCALAR,
+    TURBO_AVX2,
+    TURBO_AVX512,
+    TURBO_KERNELS
+};
+
+typedef struct
+{
+    pthread_t thread;
+    int cpu;
+    int kernel;
+    int pinned;
+    atomic_int *stop;
+    atomic_int *measure;
+    uint64_t ticks;
+    uint64_t samples;
+} turbo_thread;
+
+typedef struct
+{
+    const char *name;
+    int depth;
+    uint64_t wall_start;
+    uint64_t cpu_start;
+    uint64_t wall_nsec;
+    uint64_t cpu_nsec;
+} timing_phase;
+
+enum
+{
+    VIRT_CPUID,
+    VIRT_RDTSC,
+    VIRT_RDTSCP,
+    VIRT_CLOCK,
+    VIRT_SYSCALL,
+    VIRT_PAGE_FAULT,
+    VIRT_OPS
+};
+
+typedef struct
+{
+    const char *tier;
+    const char *name;
+    void (*run)(void);
+    int feature; /* X86_FEATURE_* the kernel needs */
+    int lane_ops; /* 32-bit operations per instruction, an FMA counts as two */
+} simd_kernel;
+
+typedef struct
+{
+    pthread_t thread;
+    int cpu;
+    int pinned;
+    const simd_kernel *kernel;
+    cpu_barrier *barrier;
+    double ipc;
+} simd_thread;
+
+typedef struct
+{
+    int version; /* 1 or 2, 0 when no cgroup CPU controller was found */
+    char cpuset[CPU_LIST_LEN];
+    long quota; /* microseconds per period, -1 for no limit */
+    long period;
+} cgroup_cpu_limits;
+
+/* -1 in any field means this platform can't tell */
+typedef struct
+{
+    int present;
+    int online;
+    int isolated;
+    int nohz_full;
+    int rcu_nocbs;
+    int core; /* lowest CPU among its SMT siblings */
+} cpu_isolation;
+
+typedef struct
+{
+    int id;
+    int cpu_num;
+    unsigned char cpus[AFFINITY_MAX_CPUS];
+    uint64_t mem_total; /* bytes, 0 if unknown */
+    uint64_t mem_free;
+    int distance[NUMA_MAX_NODES]; /* SLIT, in the order of the node array, 0 if unknown */
+} numa_node;
+
+typedef struct
+{
+    pthread_t thread;
+    int cpu;
+    int pinned;
+    void *buf;
+    size_t size;
+    size_t line;
+    cpu_barrier *barrier;
+    double latency; /* ns */
+    double bandwidth; /* GB/s */
+} numa_thread;
+
+/* The on-disk snapshot is mapped and used in place, so no pointers in here */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t build_id; /* snapshot_build_id() of the writer */
+    char boot_id[SNAPSHOT_KEY_LEN];
+    char kernel[SNAPSHOT_KERNEL_LEN];
+    gen_cpu_info gen_info;
+    x86_cpu_info x86_info;
+    cpuid_table cpuid_raw;
+} cpu_snapshot;
+
 
 /* function declarations */
-#if defined(__amd64__) || defined(__i386__)
 static int is_amd_cpu(char *vendor);
 static int is_intel_cpu(char *vendor);
 static int x86_cpu_support_standard_flag(int flag, int mask);
-static int get_x86_cpu_standard_flags(int intel, uint32_t ecx, uint32_t edx, char *flags, size_t len);
-static int get_x86_cpu_structured_extended_flags(int intel, uint32_t ebx, uint32_t ecx, char *flags, size_t len);
-static int get_x86_cpu_extended_flags(int intel, uint32_t ecx, uint32_t edx, char *flags, size_t len);
+static void set_cache_size(char *cache, const char *size);
+static void parse_intel_cache_value(x86_cpu_info *x86_info, unsigned char value);
+static void set_cache_size_bytes(char *cache, uint64_t size, int mega);
+static void format_cache_name(const x86_cache *cache, char *name, size_t len);
+static int amd_cache_ways(int code);
+static void add_amd_cache(x86_cpu_info *x86_info, int level, int type, uint64_t size, int ways, int line_size);
+static void decode_x86_caches(const cpuid_table *table, x86_cpu_info *x86_info);
+static void decode_x86_features(const cpuid_table *table, x86_cpu_info *x86_info);
+static int format_x86_flags(const uint32_t *features, char *buf, size_t len);
+static int x86_xstate_enabled(const cpuid_table *table, const x86_feature *feature);
+static int decode_x86_isa_level(const x86_cpu_info *x86_info);
+static uint32_t hash_feature_name(const char *name, size_t len);
+static int find_x86_feature(const char *name, size_t len);
+static int x86_feature_present(const cpuid_table *table, int vendor_id, int id);
+static int check_x86_features(const char *spec);
+static const uint32_t *cpuid_table_regs(const cpuid_table *table, uint32_t leaf, uint32_t subleaf);
+static int ceil_log2(uint32_t value);
+static void decode_x86_topology(const cpuid_table *table, x86_cpu_info *x86_info);
+static void decode_x86_cpu_info(const cpuid_table *table, x86_cpu_info *x86_info);
+
+#if defined(__amd64__) || defined(__i386__)
+static void cpuid_exec(cpuid_table *table, uint32_t leaf, uint32_t subleaf, uint32_t *regs);
+static const uint32_t *cpuid_table_add(cpuid_table *table, uint32_t leaf, uint32_t subleaf);
+static void capture_cpuid_leaf(cpuid_table *table, uint32_t leaf);
+static void capture_cpuid_range(cpuid_table *table, uint32_t base, uint32_t limit);
+static void capture_xcr0(cpuid_table *table);
+static void capture_cpuid_table(cpuid_table *table);
 static void get_x86_cpu_info(x86_cpu_info *x86_info);
+static void get_x86_percpu_info(percpu_info *info);
+static void capture_cpuid_features(cpuid_table *table, const int *ids, int id_num);
 #endif
 
+#ifdef __linux__
+static int read_small_file(const char *path, char *buf, size_t len);
+static int count_cpu_list(const char *list);
+static int linux_get_gen_info(gen_cpu_info *gen_info);
+static int read_cgroup_path(const char *controller, char *path, size_t len);
+static void resolve_cgroup_path(const char *root, char *path);
+static void read_cfs_quota(const char *root, char *path, int version, cgroup_cpu_limits *limits);
+static void get_cgroup_limits(cgroup_cpu_limits *limits);
+static void mark_cpu_list(const char *list, unsigned char *set, int max);
+static int read_cpu_set(const char *path, const char *param, unsigned char *set, int max);
+static int linux_get_topology(x86_cpu_info *x86_info);
+#else
+static int bsd_get_gen_info(gen_cpu_info *gen_info);
+#endif
+static sysctl_get_cpu_info *find_sysctl_entry(const char *name);
+static int dump_cpu_info(const char *path, cpuid_table *table);
+static int compare_cpuid_leaf(const void *a, const void *b);
+static int parse_cpuid_line(const char *line, cpuid_table *table);
+static int load_cpu_dump(const char *path, cpuid_table *table);
+static void parse_cpu_dump_text(char *text, size_t len, cpuid_table *table);
+static void decode_x86_brand_string(const cpuid_table *table, char *brand, size_t len);
+static uint32_t batch_hash(uint32_t value);
+static void batch_count_model(batch_stats *stats, uint32_t key, unsigned long count);
+static void batch_put_slot(batch_pool *pool, batch_slot *slot);
+static batch_slot *batch_get_slot(batch_pool *pool);
+static void batch_submit(batch_pool *pool, batch_slot *slot);
+static batch_slot *batch_take(batch_pool *pool, batch_worker *self);
+static int batch_read_file(batch_slot *slot);
+static void batch_process(batch_slot *slot, batch_stats *stats);
+static void *batch_worker_main(void *arg);
+static void batch_read_dir(batch_pool *pool, const char *path);
+static void batch_end_record(batch_pool *pool, batch_slot **slot);
+static void batch_read_stream(batch_pool *pool, FILE *fp);
+static int compare_batch_count(const void *a, const void *b);
+static void print_batch_stats(batch_stats *total);
+static void run_batch(const char *path, int worker_num);
+static int get_snapshot_key(char *boot_id, size_t boot_id_len, char *kernel, size_t kernel_len);
+static const char *get_snapshot_path(void);
+static uint32_t snapshot_build_id(void);
+static const cpu_snapshot *load_snapshot(void);
+static void save_snapshot(gen_cpu_info *gen_info, x86_cpu_info *x86_info, cpuid_table *table);
+static int bind_to_cpu(int cpu);
+static int get_affinity_cpus(int *cpus, int max);
+static int get_cpu_ids(int *cpus, int max, int cpu_num);
+static void *percpu_worker(void *arg);
+static int sweep_cpus(percpu_info *table, const int *cpus, int cpu_num);
+static uint32_t topology_field(uint32_t apic_id, int low, int high);
+static uint32_t percpu_apic_id(const percpu_info *info, const x86_cpu_info *x86_info);
+static void decode_percpu_topology(percpu_info *table, int cpu_num, const x86_cpu_info *x86_info);
+static int compare_uint64(const void *a, const void *b);
+static void count_topology(percpu_info *table, int cpu_num, x86_cpu_info *x86_info);
+static percpu_info *collect_percpu_info(const int *cpus, int cpu_num, x86_cpu_info *x86_info);
 static void usage(void);
+static uint64_t cpu_nsec(void);
+static int timing_begin(const char *name, int depth);
+static void timing_end(int id);
+static void print_timings(uint64_t wall_start, uint64_t cpu_start);
+static void run_startup_bench(const char *self, int runs);
+static uint64_t now_nsec(void);
+static void *bench_alloc(size_t size, int *huge);
+static void bench_free(void *buf, size_t size);
+static uint64_t bench_random(uint64_t *state);
+static double chase_latency(void *buf, size_t size, size_t line);
+static void cpu_barrier_init(cpu_barrier *barrier, int total);
+static void cpu_barrier_destroy(cpu_barrier *barrier);
+static void cpu_barrier_wait(cpu_barrier *barrier);
+static void *bandwidth_worker(void *arg);
+static void bench_bandwidth(const int *cpus, int cpu_num, int thread_num, size_t total);
+static void run_memory_bench(const int *cpus, int cpu_num, x86_cpu_info *x86_info, int thread_num);
+static void *numa_alloc(size_t size, int node);
+static void *numa_touch_worker(void *arg);
+static void *numa_worker(void *arg);
+static void print_numa_matrix(const char *title, const numa_node *nodes, int node_num, const double *values);
+static void run_numa_bench(x86_cpu_info *x86_info);
+static int c2c_partner(int cpu, int round, int cpu_num);
+static void *c2c_worker(void *arg);
+static int c2c_relation(const percpu_info *a, const percpu_info *b, const x86_cpu_info *x86_info);
+static void run_c2c(const int *cpus, int cpu_num, x86_cpu_info *x86_info);
+#if defined(__amd64__) || defined(__i386__)
+static uint64_t read_tsc(void);
+static double measure_tsc_hz(void);
+static void *tsc_responder(void *arg);
+static int probe_tsc_skew(int cpu, int64_t *offset, uint64_t *bound, int *violations);
+static void *tsc_measure_worker(void *arg);
+static int open_msr(int cpu);
+static int read_msr(int fd, uint32_t msr, uint64_t *value);
+static uint64_t run_cycle_loop(void);
+static void *watch_worker(void *arg);
+static void sleep_nsec(uint64_t nsec);
+static void run_watch(const int *cpu_ids, int cpu_num, x86_cpu_info *x86_info, double interval, long count);
+static void turbo_avx2_kernel(void);
+static void turbo_avx512_kernel(void);
+static void *turbo_worker(void *arg);
+static int compare_turbo_cpu(const void *a, const void *b);
+static void run_turbo_curve(const int *cpus, int cpu_num, x86_cpu_info *x86_info);
+static void simd_sse_fp(void);
+static void simd_sse_int(void);
+static void simd_sse_shuf(void);
+static void simd_avx2_fp(void);
+static void simd_avx2_int(void);
+static void simd_avx2_shuf(void);
+static void simd_avx512_fp(void);
+static void simd_avx512_int(void);
+static void simd_avx512_shuf(void);
+static double measure_simd_ipc(const simd_kernel *kernel);
+static void *simd_worker(void *arg);
+static double run_simd_threads(simd_thread *threads, int thread_num, const simd_kernel *kernel);
+static void run_simd_bench(const int *cpus, int cpu_num, x86_cpu_info *x86_info);
+#endif
+static uint32_t intel_crystal_hz(const x86_cpu_info *x86_info);
+static void print_tsc_info(const cpuid_table *table, const x86_cpu_info *x86_info, const int *cpus, int cpu_num, int measure);
+static void run_virt_op(int op, int count, volatile char *pages, long page_size);
+static int measure_virt_op(int op, double *best, double *median);
+static void print_virt_info(const cpuid_table *table, const x86_cpu_info *x86_info, int measure);
+static void print_parallelism(percpu_info *table, int cpu_num);
+static int get_cpu_isolation(cpu_isolation *cpus, int max, char *smt, size_t len, percpu_info *table, int cpu_num);
+static void print_isolation(percpu_info *table, int cpu_num);
+static int get_numa_nodes(numa_node *nodes, int max);
+static int unique_ids(uint64_t *keys, int key_num, int *ids);
+static void print_numa_info(percpu_info *table, int cpu_num, x86_cpu_info *x86_info);
 static void print_cpu_info(gen_cpu_info *gen_info, x86_cpu_info *x86_info);
+static void print_cache_info(x86_cpu_info *x86_info);
+static void print_xsave_info(const cpuid_table *table, const x86_cpu_info *x86_info);
+static void print_percpu_info(percpu_info *table, int cpu_num);
+static void print_topology(percpu_info *table, int cpu_num);
+static int format_cpu_list(const int *cpus, int cpu_num, char *buf, size_t len);
+static void print_cache_groups(percpu_info *table, int cpu_num, x86_cpu_info *x86_info);
+static void print_cpuid_stats(cpuid_table *table);
 
 
 /* variables definitions */
 gen_cpu_info gen_info;
 x86_cpu_info x86_info;
-char intel_l1d_cache[CACHE_SIZE_LEN];
-char intel_l1i_cache[CACHE_SIZE_LEN];
-char intel_l2_cache[CACHE_SIZE_LEN];
-char intel_l3_cache[CACHE_SIZE_LEN];
-char amd_l1d_cache[CACHE_SIZE_LEN];
-char amd_l1i_cache[CACHE_SIZE_LEN];
-char amd_l2_cache[CACHE_SIZE_LEN];
-char amd_l3_cache[CACHE_SIZE_LEN];
+cpuid_table cpuid_raw;
+volatile uintptr_t bench_sink; /* keeps benchmark loads from being optimized out */
+int timing_enabled;
+int timing_num;
+timing_phase timings[TIMING_MAX_PHASES];
+sysctl_get_cpu_info sysctl_array[] = {
+#ifdef __linux__
+    /* there is no sysctl(2), the BSD names only label the dump records */
+    {0, gen_info.arch, sizeof(gen_info.arch), "HW_MACHINE", 1},
+    {0, &(gen_info.byte_order), sizeof(gen_info.byte_order), "HW_BYTEORDER", 0},
+    {0, gen_info.model, sizeof(gen_info.model), "HW_MODEL", 1},
+    {0, &(gen_info.active_cpu_num), sizeof(gen_info.active_cpu_num), "HW_NCPU", 0},
+    {0, &(gen_info.total_cpu_num), sizeof(gen_info.total_cpu_num), "HW_NCPUFOUND", 0},
+#else /* BSDs */
+#ifdef __FreeBSD__
+    {HW_MACHINE_ARCH, gen_info.arch, sizeof(gen_info.arch), "HW_MACHINE_ARCH", 1},
+#else
+    {HW_MACHINE, gen_info.arch, sizeof(gen_info.arch), "HW_MACHINE", 1},
+#endif
+    {HW_BYTEORDER, &(gen_info.byte_order), sizeof(gen_info.byte_order), "HW_BYTEORDER", 0},
+    {HW_MODEL, gen_info.model, sizeof(gen_info.model), "HW_MODEL", 1},
+    {HW_NCPU, &(gen_info.active_cpu_num), sizeof(gen_info.active_cpu_num), "HW_NCPU", 0},
+#ifdef __OpenBSD__
+    {HW_VENDOR, gen_info.vendor, sizeof(gen_info.vendor), "HW_VENDOR", 1},
+    {HW_NCPUFOUND, &(gen_info.total_cpu_num), sizeof(gen_info.total_cpu_num), "HW_NCPUFOUND", 0},
+    {HW_CPUSPEED, &(gen_info.speed), sizeof(gen_info.speed), "HW_CPUSPEED", 0},
+#endif
+#endif
+};
+#ifdef __linux__
+const platform_backend platform = {"sysfs", linux_get_gen_info, linux_get_topology};
+#else
+const platform_backend platform = {"sysctl", bsd_get_gen_info, NULL};
+#endif
+
+const x86_feature x86_features[X86_FEATURE_NUM] = {
+#define X86_FEATURE(id, leaf, subleaf, reg, bit, name, vendors, xstate) \
+    {leaf, subleaf, CPUID_##reg, bit, X86_VENDORS_##vendors, X86_XSTATE_##xstate, name},
+    X86_FEATURE_LIST
+#undef X86_FEATURE
+};
+
+/* leaf 1 ecx/edx and leaf 7 ebx/ecx/edx, in percpu_info.features order */
+const char *percpu_feature_regs[PERCPU_FEATURE_WORDS] = {
+    "leaf 1 ecx", "leaf 1 edx", "leaf 7 ebx", "leaf 7 ecx", "leaf 7 edx"
+};
 
 
 /* function definitions */
-#if defined(__amd64__) || defined(__i386__)
 static int is_amd_cpu(char *vendor)
 {
     return (!strcmp(vendor, "AMDisbetter!") || !strcmp(vendor, "AuthenticAMD"));
@@ -120,30 +1099,36 @@ static int x86_cpu_support_standard_flag(int flag, int mask)
     return (flag & (1 << mask));
 }
 
+static void set_cache_size(char *cache, const char *size)
+{
+    snprintf(cache, CACHE_SIZE_LEN, "%s", size);
+    return;
+}
+
 static void parse_intel_cache_value(x86_cpu_info *x86_info, unsigned char value)
 {
     switch (value)
     {
         case 0x06:
         {
-            x86_info->l1i_cache = "8K";
+            set_cache_size(x86_info->l1i_cache, "8K");
             break;
         }
         case 0x08:
         {
-            x86_info->l1i_cache = "16K";
+            set_cache_size(x86_info->l1i_cache, "16K");
             break;
         }
         case 0x09:
         case 0x30:
         {
-            x86_info->l1i_cache = "32K";
+            set_cache_size(x86_info->l1i_cache, "32K");
             break;
         }
         case 0x0A:
         case 0x66:
         {
-            x86_info->l1d_cache = "8K";
+            set_cache_size(x86_info->l1d_cache, "8K");
             break;
         }
         case 0x0C:
@@ -151,13 +1136,13 @@ static void parse_intel_cache_value(x86_cpu_info *x86_info, unsigned char value)
         case 0x60:
         case 0x67:
         {
-            x86_info->l1d_cache = "16K";
+            set_cache_size(x86_info->l1d_cache, "16K");
             break;
         }
         case 0x68:
         case 0x2C:
         {
-            x86_info->l1d_cache = "32K";
+            set_cache_size(x86_info->l1d_cache, "32K");
             break;
         }
         case 0x39:
@@ -165,12 +1150,12 @@ static void parse_intel_cache_value(x86_cpu_info *x86_info, unsigned char value)
         case 0x41:
         case 0x79:
         {
-            x86_info->l2_cache = "128K";
+            set_cache_size(x86_info->l2_cache, "128K");
             break;
         }
         case 0x3A:
         {
-            x86_info->l2_cache = "192K";
+            set_cache_size(x86_info->l2_cache, "192K");
             break;
         }
         case 0x3C:
@@ -178,12 +1163,12 @@ static void parse_intel_cache_value(x86_cpu_info *x86_info, unsigned char value)
         case 0x7A:
         case 0x82:
         {
-            x86_info->l2_cache = "256K";
+            set_cache_size(x86_info->l2_cache, "256K");
             break;
         }
         case 0x3D:
         {
-            x86_info->l2_cache = "384K";
+            set_cache_size(x86_info->l2_cache, "384K");
             break;
         }
         case 0x3E:
@@ -193,7 +1178,7 @@ static void parse_intel_cache_value(x86_cpu_info *x86_info, unsigned char value)
         case 0x83:
         case 0x86:
         {
-            x86_info->l2_cache = "512K";
+            set_cache_size(x86_info->l2_cache, "512K");
             break;
         }
         case 0x44:
@@ -201,51 +1186,52 @@ static void parse_intel_cache_value(x86_cpu_info *x86_info, unsigned char value)
         case 0x84:
         case 0x87:
         {
-            x86_info->l2_cache = "1M";
+            set_cache_size(x86_info->l2_cache, "1M");
             break;
         }
         case 0x45:
         case 0x7D:
         case 0x85:
         {
-            x86_info->l2_cache = "2M";
+            set_cache_size(x86_info->l2_cache, "2M");
             break;
         }
         case 0x48:
         {
-            x86_info->l2_cache = "3M";
+            set_cache_size(x86_info->l2_cache, "3M");
             break;
         }
         case 0x4E:
         {
-            x86_info->l2_cache = "6M";
+            set_cache_size(x86_info->l2_cache, "6M");
             break;
         }
         case 0x49:
         {
-            x86_info->l3_cache = x86_info->l2_cache = "4M";
+            set_cache_size(x86_info->l2_cache, "4M");
+            set_cache_size(x86_info->l3_cache, "4M");
             break;
         }
         case 0xD0:
         {
-            x86_info->l3_cache = "512K";
+            set_cache_size(x86_info->l3_cache, "512K");
             break;
         }
         case 0x23:
         case 0xD1:
         case 0xD6:
         {
-            x86_info->l3_cache = "1M";
+            set_cache_size(x86_info->l3_cache, "1M");
             break;
         }
         case 0xDC:
         {
-            x86_info->l3_cache = "1.5M";
+            set_cache_size(x86_info->l3_cache, "1.5M");
             break;
         }
         case 0xDD:
         {
-            x86_info->l3_cache = "3M";
+            set_cache_size(x86_info->l3_cache, "3M");
             break;
         }
         case 0x25:
@@ -253,7 +1239,7 @@ static void parse_intel_cache_value(x86_cpu_info *x86_info, unsigned char value)
         case 0xD7:
         case 0xE2:
         {
-            x86_info->l3_cache = "2M";
+            set_cache_size(x86_info->l3_cache, "2M");
             break;
         }
         case 0x29:
@@ -261,46 +1247,41 @@ static void parse_intel_cache_value(x86_cpu_info *x86_info, unsigned char value)
         case 0xD8:
         case 0xE3:
         {
-            x86_info->l3_cache = "4M";
+            set_cache_size(x86_info->l3_cache, "4M");
             break;
         }
         case 0x4A:
         case 0xDE:
         {
-            x86_info->l3_cache = "6M";
+            set_cache_size(x86_info->l3_cache, "6M");
             break;
         }
         case 0x47:
         case 0x4B:
         case 0xE4:
         {
-            x86_info->l3_cache = "8M";
+            set_cache_size(x86_info->l3_cache, "8M");
             break;
         }
         case 0x4C:
         case 0xEA:
         {
-            x86_info->l3_cache = "12M";
+            set_cache_size(x86_info->l3_cache, "12M");
             break;
         }
         case 0x4D:
         {
-            x86_info->l3_cache = "16M";
+            set_cache_size(x86_info->l3_cache, "16M");
             break;
         }
         case 0xEB:
         {
-            x86_info->l3_cache = "18M";
+            set_cache_size(x86_info->l3_cache, "18M");
             break;
         }
         case 0xEC:
         {
-            x86_info->l3_cache = "24M";
-            break;
-        }
-        case 0xFF:
-        {
-            x86_info->intel_use_leaf_4_get_cache = 1;
+            set_cache_size(x86_info->l3_cache, "24M");
             break;
         }
         default:
@@ -311,690 +1292,6370 @@ static void parse_intel_cache_value(x86_cpu_info *x86_info, unsigned char value)
     return;
 }
 
-static int get_x86_cpu_standard_flags(int intel, uint32_t ecx, uint32_t edx, char *flags, size_t len)
-{
-    return snprintf(flags, len,
-                /* edx*/
-                "%s%s%s%s"
-                "%s%s%s%s"
-                "%s%s%s"
-                "%s%s%s%s"
-                "%s%s%s%s"
-                "%s%s%s"
-                "%s%s%s%s"
-                "%s%s%s"
-                
-                /* ecx */
-                "%s%s%s%s"
-                "%s%s%s%s"
-                "%s%s%s%s"
-                "%s%s%s%s"
-                "%s%s%s"
-                "%s%s%s%s"
-                "%s%s%s%s"
-                "%s%s%s%s",
-
-                edx & 0x00000001 ? "fpu " : "",
-                edx & 0x00000002 ? "vme " : "",
-                edx & 0x00000004 ? "de " : "",
-                edx & 0x00000008 ? "pse " : "",
-                
-                edx & 0x00000010 ? "tsc " : "",
-                edx & 0x00000020 ? "msr " : "",
-                edx & 0x00000040 ? "pae " : "",
-                edx & 0x00000080 ? "mce " : "",
-                
-                edx & 0x00000100 ? "cx8 " : "",
-                edx & 0x00000200 ? "apic " : "",
-                edx & 0x00000800 ? "sep " : "",
-                
-                edx & 0x00001000 ? "mtrr " : "",
-                edx & 0x00002000 ? "pge " : "",
-                edx & 0x00004000 ? "mca " : "",
-                edx & 0x00008000 ? "cmov " : "",
-                
-                edx & 0x00010000 ? "pat " : "",
-                edx & 0x00020000 ? "pse36 " : "",
-                intel ? (edx & 0x00040000 ? "psn " : "") : "",
-                edx & 0x00080000 ? "cflsh " : "",
-                
-                intel ? (edx & 0x00200000 ? "ds " : "") : "",
-                intel ? (edx & 0x00400000 ? "acpi " : "") : "",
-                edx & 0x00800000 ? "mmx " : "",
-                
-                edx & 0x01000000 ? "fxsr " : "",
-                edx & 0x02000000 ? "sse " : "",
-                edx & 0x04000000 ? "sse2 " : "",
-                intel ? (edx & 0x08000000 ? "ss " : "") : "",
-                
-                edx & 0x10000000 ? "htt " : "",
-                intel ? (edx & 0x20000000 ? "tm " : "") : "",
-                intel ? (edx & 0x80000000 ? "pbe " : "") : "",
-
-                ecx & 0x00000001 ? "sse3 " : "",
-                ecx & 0x00000002 ? "pclmulqdq " : "",
-                intel ? (ecx & 0x00000004 ? "dtes64 " : "") : "",
-                ecx & 0x00000008 ? "monitor " : "",
-                
-                intel ? (ecx & 0x00000010 ? "ds_cpl " : "") : "",
-                intel ? (ecx & 0x00000020 ? "vmx " : "") : "",
-                intel ? (ecx & 0x00000040 ? "smx " : "") : "",
-                intel ? (ecx & 0x00000080 ? "est " : "") : "",
-                
-                intel ? (ecx & 0x00000100 ? "tm2 " : "") : "",
-                ecx & 0x00000200 ? "ssse3 " : "",
-                intel ? (ecx & 0x00000400 ? "cnxt-id " : "") : "",
-                intel ? (ecx & 0x00000800 ? "sdbg " : "") : "",
-
-                ecx & 0x00001000 ? "fma " : "",
-                ecx & 0x00002000 ? "cx16 " : "",
-                intel ? (ecx & 0x00004000 ? "xtpr " : "") : "",
-                intel ? (ecx & 0x00008000 ? "pdcm " : "") : "",
-
-                intel ? (ecx & 0x00020000 ? "pcid " : "") : "", 
-                intel ? (ecx & 0x00040000 ? "dca " : "") : "",
-                ecx & 0x00080000 ? "sse4_1 " : "",
-
-                ecx & 0x00100000 ? "sse4_2 " : "",
-                intel ? (ecx & 0x00200000 ? "x2apic " : "") : "", 
-                intel ? (ecx & 0x00400000 ? "movbe " : "") : "",
-                ecx & 0x00800000 ? "popcnt " : "",
-
-                intel ? (ecx & 0x01000000 ? "tsc_deadline " : "") : "",
-                ecx & 0x02000000 ? "aes " : "",
-                ecx & 0x04000000 ? "xsave " : "",
-                ecx & 0x08000000 ? "osxsave " : "",
-
-                ecx & 0x10000000 ? "avx " : "",
-                ecx & 0x20000000 ? "f16c " : "",
-                ecx & 0x40000000 ? "rdrnd " : "",
-                ecx & 0x80000000 ? "hypervisor " : "");
-}
-
-static int get_x86_cpu_structured_extended_flags(int intel, uint32_t ebx, uint32_t ecx, char *flags, size_t len)
-{
-    return snprintf(flags, len,
-                /* ebx */
-                "%s%s%s%s"
-                "%s%s%s%s"
-                "%s%s%s%s"
-                "%s%s%s%s"
-                "%s%s%s%s"
-                "%s%s"
-                "%s%s"
-                "%s"
-                /* ecx */
-                "%s%s%s"
-                "%s"
-                "%s"
-                "%s",
-
-                ebx & 0x00000001 ? "fsgsbase " : "",
-                intel ? (ebx & 0x00000002 ? "tsc_adjust " : "") : "",
-                intel ? (ebx & 0x00000004 ? "sgx " : "") : "",
-                ebx & 0x00000008 ? "bmi1 " : "",
-
-                intel ? (ebx & 0x00000010 ? "hle " : "") : "",
-                ebx & 0x00000020 ? "avx2 " : "",
-                intel ? (ebx & 0x00000040 ? "fp_dp " : "") : "",
-                ebx & 0x00000080 ? "smep " : "",
-
-                ebx & 0x00000100 ? "bmi2 " : "",
-                intel ? (ebx & 0x00000200 ? "erms " : "") : "",
-                intel ? (ebx & 0x00000400 ? "invpcid " : "") : "",
-                intel ? (ebx & 0x00000800 ? "rtm " : "") : "",
-                
-                intel ? (ebx & 0x00001000 ? "pqm " : "") : "",
-                intel ? (ebx & 0x00002000 ? "fpcsds " : "") : "",
-                intel ? (ebx & 0x00004000 ? "mpx " : "") : "",
-                intel ? (ebx & 0x00008000 ? "pqe " : "") : "",
-
-                intel ? (ebx & 0x00010000 ? "pat " : "") : "",
-                intel ? (ebx & 0x00020000 ? "pse36 " : "") : "",
-                intel ? (ebx & 0x00040000 ? "rdseed " : "") : "",
-                intel ? (ebx & 0x00080000 ? "adx " : "") : "",
-
-                intel ? (ebx & 0x00100000 ? "smap " : "") : "",
-                intel ? (ebx & 0x00800000 ? "clflushopt " : "") : "",
-
-                intel ? (ebx & 0x01000000 ? "clwb " : "") : "",
-                intel ? (ebx & 0x02000000 ? "intel_pt " : "") : "",
-
-                intel ? (ebx & 0x10000000 ? "sha " : "") : "",
-
-                intel ? (ecx & 0x00000001 ? "prefetchwt1 " : "") : "",
-                intel ? (ecx & 0x00000004 ? "umip " : "") : "",
-                intel ? (ecx & 0x00000008 ? "pku " : "") : "",
-
-                intel ? (ecx & 0x00000010 ? "ospke " : "") : "",
-
-                intel ? (ecx & 0x00040000 ? "rdpid " : "") : "",
-
-                intel ? (ecx & 0x40000000 ? "sgx_lc " : "") : "");
-}
-
-static int get_x86_cpu_extended_flags(int intel, uint32_t ecx, uint32_t edx, char *flags, size_t len)
-{
-    return snprintf(flags, len,
-                /* edx*/
-                ""
-                ""
-                "%s"
-                ""
-                "%s"
-                "%s%s"
-                "%s%s%s"
-                "%s%s%s"
-                
-                /* ecx */
-                "%s%s%s%s"
-                "%s%s%s%s"
-                "%s%s%s%s"
-                "%s%s%s"
-                "%s%s%s"
-                "%s%s%s"
-                "%s%s%s"
-                "%s",
-
-                edx & 0x00000800 ? "syscall " : "",
-
-                intel ? "" : (edx & 0x00080000 ? "mp " : ""),
-
-                edx & 0x00100000 ? "nx " : "",
-                intel ? "" : (edx & 0x00400000 ? "mmxext " : ""),
-
-                intel ? "" : (edx & 0x02000000 ? "fxsr_opt " : ""),
-                edx & 0x04000000 ? "pdpe1gb " : "",
-                edx & 0x08000000 ? "rdtscp " : "",
-
-                edx & 0x20000000 ? "lm " : "",
-                intel ? "" : (edx & 0x40000000 ? "3dnowext " : ""),
-                intel ? "" : (edx & 0x80000000 ? "3dnow " : ""),
-
-                ecx & 0x00000001 ? "lahf_lm " : "",
-                intel ? "" : (ecx & 0x00000002 ? "cmp_legacy " : ""),
-                intel ? "" : (ecx & 0x00000004 ? "svm " : ""),
-                intel ? "" : (ecx & 0x00000008 ? "extapic " : ""),
-
-                intel ? "" : (ecx & 0x00000010 ? "cr8_legacy " : ""),
-                ecx & 0x00000020 ? "lzcnt " : "",
-                intel ? "" : (ecx & 0x00000040 ? "sse4a " : ""),
-                intel ? "" : (ecx & 0x00000080 ? "misalignsse " : ""),
-
-                intel ? "" : (ecx & 0x00000100 ? "3dnowprefetch " : ""),
-                intel ? "" : (ecx & 0x00000200 ? "osvw " : ""),
-                intel ? "" : (ecx & 0x00000400 ? "ibs " : ""),
-                intel ? "" : (ecx & 0x00000800 ? "xop " : ""),
-
-                intel ? "" : (ecx & 0x00001000 ? "skinit " : ""),
-                intel ? "" : (ecx & 0x00002000 ? "wdt " : ""),
-                intel ? "" : (ecx & 0x00008000 ? "lwp " : ""),
-
-                intel ? "" : (ecx & 0x00010000 ? "fma4 " : ""),
-                intel ? "" : (ecx & 0x00020000 ? "tce " : ""),
-                intel ? "" : (ecx & 0x00080000 ? "nodeid_msr " : ""),
+static void set_cache_size_bytes(char *cache, uint64_t size, int mega)
+{
+    if (mega && (size >= 1024 * 1024))
+    {
+        snprintf(cache, CACHE_SIZE_LEN, "%uM", (unsigned int)(size / (1024 * 1024)));
+    }
+    else
+    {
+        /* 32 bits of KB cover any cache, and keep the string short */
+        snprintf(cache, CACHE_SIZE_LEN, "%uK", (unsigned int)(size / 1024));
+    }
+    return;
+}
 
-                intel ? "" : (ecx & 0x00200000 ? "tbm " : ""),
-                intel ? "" : (ecx & 0x00400000 ? "topoext " : ""),
-                intel ? "" : (ecx & 0x00800000 ? "perfctr_core " : ""),
+/* L1d, L1i, L2, ... */
+static void format_cache_name(const x86_cache *cache, char *name, size_t len)
+{
+    snprintf(name, len, "L%d%s", cache->level, (cache->type == 1) ? "d" : ((cache->type == 2) ? "i" : ""));
+    return;
+}
 
-                intel ? "" : (ecx & 0x01000000 ? "perfctr_nb " : ""),
-                intel ? "" : (ecx & 0x02000000 ? "dbx " : ""),
-                intel ? "" : (ecx & 0x08000000 ? "perftsc " : ""),
+/* Ways from the 4-bit associativity code of AMD leaf 0x80000006 */
+static int amd_cache_ways(int code)
+{
+    static const uint8_t ways[16] = {0, 1, 2, 3, 4, 6, 8, 0, 16, 0, 32, 48, 64, 96, 128, 0xFF};
 
-                intel ? "" : (ecx & 0x10000000 ? "pcx_l2i " : ""));
+    return ways[code & 0xF];
 }
 
-
-static void get_x86_cpu_info(x86_cpu_info *x86_info)
+static void add_amd_cache(x86_cpu_info *x86_info, int level, int type, uint64_t size, int ways, int line_size)
 {
-    int i = 0, flag_len = 0;
-    uint32_t eax, ebx, ecx, edx;
-    
-    __cpuid(0, eax, ebx, ecx, edx);
-    memcpy(x86_info->vendor, &ebx, sizeof(ebx));
-    memcpy(&(x86_info->vendor[4]), &edx, sizeof(edx));
-    memcpy(&(x86_info->vendor[8]), &ecx, sizeof(ecx));
-    for (i = 0; (i <= eax) && (i <= CPUID_MAX_STANDARD_FUNCTION); i++)
+    x86_cache *cache = NULL;
+
+    if (!size || !line_size || (x86_info->cache_num == X86_MAX_CACHES))
     {
-        x86_info->standard_mask |= (1 << i);
+        return;
     }
-
-    __cpuid(0x80000000, eax, ebx, ecx, edx);
-    eax &= ~0x80000000;
-    for (i = 0; (i <= eax) && (i <= CPUID_MAX_EXTENDED_FUNCTION); i++)
+    cache = &x86_info->caches[x86_info->cache_num++];
+    cache->level = level;
+    cache->type = type;
+    cache->line_size = line_size;
+    cache->partitions = 1;
+    cache->size = size;
+    if (ways == 0xFF)
+    {
+        cache->fully_associative = 1;
+        cache->ways = size / line_size;
+    }
+    else
     {
-        x86_info->extended_mask |= (1 << i);
+        cache->ways = ways;
     }
+    cache->sets = cache->ways ? size / ((uint64_t)line_size * cache->ways) : 0;
+    return;
+}
+
+/*
+ * Every cache level from the deterministic cache parameters leaf, which is
+ * 4 on Intel and 0x8000001D on AMD. Old AMD parts without it fall back to
+ * 0x80000005/6, which give no sharing or inclusivity.
+ */
+static void decode_x86_caches(const cpuid_table *table, x86_cpu_info *x86_info)
+{
+    int i = 0, amd = (x86_info->vendor_id == X86_VENDOR_AMD);
+    uint32_t subleaf = 0;
+    uint32_t leaf = amd ? (0x80000000 | CPUID_EXTENDED_1D_MASK) : CPUID_STANDARD_4_MASK;
+    const uint32_t *regs = NULL;
 
-    eax = CPUID_STANDARD_1_MASK;
-    if (x86_info->standard_mask & (1 << eax))
+    for (subleaf = 0; (x86_info->cache_num < X86_MAX_CACHES) && (regs = cpuid_table_regs(table, leaf, subleaf)); subleaf++)
     {
-        __cpuid(eax, eax, ebx, ecx, edx);
-        x86_info->stepping = eax & 0xF;
-        x86_info->family = (eax >> 8) & 0xF;
-        x86_info->model = (eax >> 4) & 0xF;
-        if ((x86_info->family == 6) || (x86_info->family == 15))
+        x86_cache *cache = &x86_info->caches[x86_info->cache_num];
+        uint32_t eax = regs[CPUID_EAX], ebx = regs[CPUID_EBX];
+
+        if (!(eax & 0x1F))
         {
-            x86_info->model |= (eax >> 12) & 0xF0;
-            if (x86_info->family == 15)
-            {
-                x86_info->family += (eax >> 20) & 0xFF;
-            }
+            break;
         }
-        if (is_intel_cpu(x86_info->vendor))
+        cache->type = eax & 0x1F;
+        cache->level = (eax >> 5) & 0x7;
+        cache->fully_associative = (eax >> 9) & 0x1;
+        cache->sharing = ((eax >> 14) & 0xFFF) + 1;
+        cache->line_size = (ebx & 0xFFF) + 1;
+        cache->partitions = ((ebx >> 12) & 0x3FF) + 1;
+        cache->ways = ((ebx >> 22) & 0x3FF) + 1;
+        cache->sets = regs[CPUID_ECX] + 1;
+        cache->inclusive = (regs[CPUID_EDX] >> 1) & 0x1;
+        cache->size = (uint64_t)cache->ways * cache->partitions * cache->line_size * cache->sets;
+        x86_info->cache_num++;
+    }
+
+    if (amd && !x86_info->cache_num)
+    {
+        if ((regs = cpuid_table_regs(table, 0x80000000 | CPUID_EXTENDED_5_MASK, 0)))
         {
-            flag_len += get_x86_cpu_standard_flags(1, ecx, edx, x86_info->flags + flag_len, sizeof(x86_info->flags) - flag_len);
+            add_amd_cache(x86_info, 1, 1, (uint64_t)((regs[CPUID_ECX] >> 24) & 0xFF) * 1024,
+                            (regs[CPUID_ECX] >> 16) & 0xFF, regs[CPUID_ECX] & 0xFF);
+            add_amd_cache(x86_info, 1, 2, (uint64_t)((regs[CPUID_EDX] >> 24) & 0xFF) * 1024,
+                            (regs[CPUID_EDX] >> 16) & 0xFF, regs[CPUID_EDX] & 0xFF);
         }
-        else if (is_amd_cpu(x86_info->vendor))
+        if ((regs = cpuid_table_regs(table, 0x80000000 | CPUID_EXTENDED_6_MASK, 0)))
         {
-            flag_len += get_x86_cpu_standard_flags(0, ecx, edx, x86_info->flags + flag_len, sizeof(x86_info->flags) - flag_len);
+            add_amd_cache(x86_info, 2, 3, (uint64_t)((regs[CPUID_ECX] >> 16) & 0xFFFF) * 1024,
+                            amd_cache_ways(regs[CPUID_ECX] >> 12), regs[CPUID_ECX] & 0xFF);
+            add_amd_cache(x86_info, 3, 3, (uint64_t)((regs[CPUID_EDX] >> 18) & 0x3FFF) * 512 * 1024,
+                            amd_cache_ways(regs[CPUID_EDX] >> 12), regs[CPUID_EDX] & 0xFF);
         }
     }
 
-    eax = CPUID_STANDARD_2_MASK;
-    if ((is_intel_cpu(x86_info->vendor)) && (x86_info->standard_mask & (1 << eax)))
+    for (i = 0; i < x86_info->cache_num; i++)
     {
-        int i = 0, count = 0;
-        uint32_t cache[4]; /* eax, ebx, ecx, edx */
-        
-        __cpuid(eax, cache[0], cache[1], cache[2], cache[3]);
-        count = cache[0] & 0xFF;
-        while (count--)
+        const x86_cache *cache = &x86_info->caches[i];
+
+        if (cache->level == 1)
         {
-            for (i = 0; i < 4; i++)
+            if (cache->type == 1)
             {
-                if (!(cache[i] & 0x80000000))
-                {
-                    if (i)
-                    {
-                        parse_intel_cache_value(x86_info, cache[i] & 0xFF);
-                    }
-                    parse_intel_cache_value(x86_info, (cache[i] >> 8) & (0xFF));
-                    parse_intel_cache_value(x86_info, (cache[i] >> 16) & (0xFF));
-                    parse_intel_cache_value(x86_info, (cache[i] >> 24) & (0xFF));
-                }
+                set_cache_size_bytes(x86_info->l1d_cache, cache->size, 0);
+            }
+            else if (cache->type == 2)
+            {
+                set_cache_size_bytes(x86_info->l1i_cache, cache->size, 0);
             }
         }
+        else if ((cache->level == 2) && (cache->type == 3))
+        {
+            set_cache_size_bytes(x86_info->l2_cache, cache->size, 0);
+        }
+        else if ((cache->level == 3) && (cache->type == 3))
+        {
+            set_cache_size_bytes(x86_info->l3_cache, cache->size, 1);
+        }
     }
+    return;
+}
+
+static void decode_x86_features(const cpuid_table *table, x86_cpu_info *x86_info)
+{
+    int i = 0, vendors = 1 << x86_info->vendor_id;
+    const uint32_t *regs = NULL;
+    const x86_feature *prev = NULL;
 
-    if ((is_intel_cpu(x86_info->vendor)) && (x86_info->standard_mask & (1 << eax)) && (x86_info->intel_use_leaf_4_get_cache))
+    for (i = 0; i < X86_FEATURE_NUM; i++)
     {
-        int subleaf = 0;
-        for (subleaf = 0; ; subleaf++)
+        const x86_feature *feature = &x86_features[i];
+
+        if (!(feature->vendors & vendors))
         {
-            unsigned char cache_type = 0, cache_level = 0;
-            int cache_size;
+            continue;
+        }
 
-            __cpuid_count(CPUID_STANDARD_4_MASK, subleaf, eax, ebx, ecx, edx);
-            
-            cache_type = eax & 0x1F;
-            if (!cache_type)
-            {
-                break;
-            }
+        /* the table is grouped by leaf, only search when it changes */
+        if (!prev || (prev->leaf != feature->leaf) || (prev->subleaf != feature->subleaf))
+        {
+            regs = cpuid_table_regs(table, feature->leaf, feature->subleaf);
+            prev = feature;
+        }
 
-            cache_size = (int)((((ebx >> 22) & 0x3FF) + 1) * (((ebx >> 10) & 0x3FF) + 1) * 
-                            ((ebx & 0xFFF) + 1) * (ecx + 1) / 1024);
-            if (!cache_size)
+        if (regs && (regs[feature->reg] & (1U << feature->bit)))
+        {
+            if (x86_xstate_enabled(table, feature))
             {
-                break;
+                x86_info->features[i / 32] |= 1U << (i % 32);
             }
-
-            cache_level = (eax >> 5) & 0x7;
-            switch (cache_level)
+            else
             {
-                case 1:
-                {
-                    if (cache_type == 1)
-                    {
-                        snprintf(intel_l1d_cache, sizeof(intel_l1d_cache), "%dK", cache_size);
-                        x86_info->l1d_cache = intel_l1d_cache;
-                    }
-                    else if (cache_type == 2)
-                    {
-                        snprintf(intel_l1i_cache, sizeof(intel_l1i_cache), "%dK", cache_size);
-                        x86_info->l1i_cache = intel_l1i_cache;
-                    }
-                    break;
-                }
-                case 2:
-                {
-                    if (cache_type == 3)
-                    {
-                        snprintf(intel_l2_cache, sizeof(intel_l2_cache), "%dK", cache_size);
-                        x86_info->l2_cache = intel_l2_cache;
-                    }
-                    break;
-                }
-                case 3:
-                {
-                    if (cache_type == 3)
-                    {
-                        int mega_size = cache_size / 1024;
-                        if (mega_size)
-                        {
-                            snprintf(intel_l3_cache, sizeof(intel_l3_cache), "%dM", cache_size / 1024);
-                        }
-                        else
-                        {
-                            snprintf(intel_l3_cache, sizeof(intel_l3_cache), "%dK", cache_size);
-                        }
-                        x86_info->l3_cache = intel_l3_cache;
-                    }
-                    break;
-                }
-                default:
-                {
-                    break;
-                }
+                x86_info->disabled[i / 32] |= 1U << (i % 32);
             }
         }
     }
 
-    eax = CPUID_STANDARD_7_MASK;
-    ecx = 0;
-    if (x86_info->standard_mask & (1 << eax))
+    x86_info->xcr0 = table->xcr0;
+    x86_info->xcr0_valid = table->xcr0_valid;
+    x86_info->isa_level = decode_x86_isa_level(x86_info);
+    return;
+}
+
+/* Render a feature bitset as a space separated list of names */
+static int format_x86_flags(const uint32_t *features, char *buf, size_t len)
+{
+    int i = 0, n = 0;
+
+    buf[0] = '\0';
+    for (i = 0; i < X86_FEATURE_NUM; i++)
     {
-        __cpuid(eax, eax, ebx, ecx, edx);
-        if (is_intel_cpu(x86_info->vendor))
+        if ((features[i / 32] >> (i % 32)) & 1)
         {
-            flag_len += get_x86_cpu_structured_extended_flags(1, ebx, ecx, x86_info->flags + flag_len, sizeof(x86_info->flags) - flag_len);
-        }
-        else if (is_amd_cpu(x86_info->vendor))
-        {
-            flag_len += get_x86_cpu_structured_extended_flags(0, ebx, ecx, x86_info->flags + flag_len, sizeof(x86_info->flags) - flag_len);
+            n += snprintf(buf + n, (n < len) ? len - n : 0, "%s%s", n ? " " : "", x86_features[i].name);
         }
     }
+    return n;
+}
 
-    if ((is_intel_cpu(x86_info->vendor)) && (x86_info->standard_mask & (1 << CPUID_STANDARD_B_MASK)))
-    {
-        int subleaf = 0;
-        for (subleaf = 0; ; subleaf++)
-        {
-            int level_type = 0;
-            __cpuid_count(CPUID_STANDARD_B_MASK, subleaf, eax, ebx, ecx, edx);
-            
-            if (!eax && !ebx)
-            {
-                break;
-            }
+/*
+ * A flag whose register state the OS hasn't enabled in XCR0 faults when
+ * used, whatever CPUID says.
+ */
+static int x86_xstate_enabled(const cpuid_table *table, const x86_feature *feature)
+{
+    return !table->xcr0_valid || ((table->xcr0 & feature->xstate) == feature->xstate);
+}
 
-            level_type = (ecx >> 8) & 0xFF;
-            if (level_type == 1)
-            {
-                x86_info->threads_per_core = ebx;
-            }
-            else if (level_type == 2)
+/* The highest x86-64 psABI level whose flags are all usable */
+static int decode_x86_isa_level(const x86_cpu_info *x86_info)
+{
+    static const int levels[][10] = {
+        {X86_FEATURE_CMOV, X86_FEATURE_CX8, X86_FEATURE_FPU, X86_FEATURE_FXSR,
+            X86_FEATURE_MMX, X86_FEATURE_SSE, X86_FEATURE_SSE2, X86_FEATURE_LM, -1},
+        {X86_FEATURE_CX16, X86_FEATURE_LAHF_LM, X86_FEATURE_POPCNT, X86_FEATURE_SSE3,
+            X86_FEATURE_SSE4_1, X86_FEATURE_SSE4_2, X86_FEATURE_SSSE3, -1},
+        {X86_FEATURE_AVX, X86_FEATURE_AVX2, X86_FEATURE_BMI1, X86_FEATURE_BMI2,
+            X86_FEATURE_F16C, X86_FEATURE_FMA, X86_FEATURE_LZCNT, X86_FEATURE_MOVBE, X86_FEATURE_OSXSAVE, -1},
+        {X86_FEATURE_AVX512F, X86_FEATURE_AVX512BW, X86_FEATURE_AVX512CD,
+            X86_FEATURE_AVX512DQ, X86_FEATURE_AVX512VL, -1},
+    };
+    int level = 0, i = 0;
+
+    for (level = 0; level < ARRAY_LEN(levels); level++)
+    {
+        for (i = 0; levels[level][i] != -1; i++)
+        {
+            if (!X86_HAS_FEATURE(x86_info, levels[level][i]))
             {
-                x86_info->cores_per_socket = ebx;
+                return level;
             }
         }
+    }
+    return level;
+}
 
-        if (x86_info->threads_per_core)
-        {
-            x86_info->cores_per_socket = x86_info->cores_per_socket / x86_info->threads_per_core;
-        }
+static uint32_t hash_feature_name(const char *name, size_t len)
+{
+    uint32_t hash = 2166136261u;
+
+    /* FNV-1a */
+    while (len--)
+    {
+        hash = (hash ^ (unsigned char)*name++) * 16777619u;
     }
+    return hash;
+}
 
-    if (x86_info->extended_mask & (1 << CPUID_EXTENDED_1_MASK))
+/*
+ * Map a flag name to its X86_FEATURE_* index, or -1. The open addressing
+ * index over x86_features[] is built on first use.
+ */
+static int find_x86_feature(const char *name, size_t len)
+{
+    static short index[X86_FEATURE_HASH_SIZE];
+    static int built = 0;
+    int i = 0;
+    uint32_t slot = 0;
+
+    if (!built)
     {
-        __cpuid(0x80000000 | CPUID_EXTENDED_1_MASK, eax, ebx, ecx, edx);
-        if (is_intel_cpu(x86_info->vendor))
-        {
-            flag_len += get_x86_cpu_extended_flags(1, ecx, edx, x86_info->flags + flag_len, sizeof(x86_info->flags) - flag_len);
-        }
-        else if (is_amd_cpu(x86_info->vendor))
+        for (i = 0; i < X86_FEATURE_NUM; i++)
         {
-            flag_len += get_x86_cpu_extended_flags(0, ecx, edx, x86_info->flags + flag_len, sizeof(x86_info->flags) - flag_len);
+            slot = hash_feature_name(x86_features[i].name, strlen(x86_features[i].name));
+            while (index[slot & (X86_FEATURE_HASH_SIZE - 1)])
+            {
+                slot++;
+            }
+            index[slot & (X86_FEATURE_HASH_SIZE - 1)] = i + 1;
         }
+        built = 1;
     }
 
-    if ((is_amd_cpu(x86_info->vendor)) && (x86_info->extended_mask & (1 << CPUID_EXTENDED_5_MASK)))
+    for (slot = hash_feature_name(name, len); (i = index[slot & (X86_FEATURE_HASH_SIZE - 1)]); slot++)
     {
-        int kilo_size = 0;
-        __cpuid(0x80000000 | CPUID_EXTENDED_5_MASK, eax, ebx, ecx, edx);
-
-        kilo_size = (ecx >> 24) & 0xFF;
-        if (kilo_size)
-        {
-            snprintf(amd_l1d_cache, sizeof(amd_l1d_cache), "%dK", kilo_size);
-            x86_info->l1d_cache = amd_l1d_cache;
-        }
+        const char *candidate = x86_features[i - 1].name;
 
-        kilo_size = (edx >> 24) & 0xFF;
-        if (kilo_size)
+        if (!strncmp(candidate, name, len) && !candidate[len])
         {
-            snprintf(amd_l1i_cache, sizeof(amd_l1i_cache), "%dK", kilo_size);
-            x86_info->l1i_cache = amd_l1i_cache;
+            return i - 1;
         }
     }
+    return -1;
+}
+
+static int x86_feature_present(const cpuid_table *table, int vendor_id, int id)
+{
+    const x86_feature *feature = &x86_features[id];
+    const uint32_t *regs = NULL;
 
-    if ((is_amd_cpu(x86_info->vendor)) && (x86_info->extended_mask & (1 << CPUID_EXTENDED_6_MASK)))
+    if (!(feature->vendors & (1 << vendor_id)))
     {
-        int kilo_size = 0, mega_size = 0;
+        return 0;
+    }
+    regs = cpuid_table_regs(table, feature->leaf, feature->subleaf);
+    return regs && (regs[feature->reg] & (1U << feature->bit)) && x86_xstate_enabled(table, feature);
+}
+
+#if defined(__amd64__) || defined(__i386__)
+/*
+ * Execute only the leaves holding the requested features, in ascending
+ * order so the table stays sorted.
+ */
+static void capture_cpuid_features(cpuid_table *table, const int *ids, int id_num)
+{
+    int i = 0, j = 0, leaf_num = 0;
+    uint32_t max_standard = 0, max_extended = 0;
+    const uint32_t *regs = NULL;
+    cpuid_leaf leaves[CHECK_MAX_FEATURES + 1];
 
-        __cpuid(0x80000000 | CPUID_EXTENDED_6_MASK, eax, ebx, ecx, edx);
+    for (i = 0; i < id_num; i++)
+    {
+        const x86_feature *feature = &x86_features[ids[i]];
 
-        kilo_size = (ecx >> 16) & 0xFFFF;
-        if (kilo_size)
+        /* an XSAVE-managed feature needs leaf 1 for capture_xcr0() */
+        if (feature->xstate)
         {
-            snprintf(amd_l2_cache, sizeof(amd_l2_cache), "%dK", kilo_size);
-            x86_info->l2_cache = amd_l2_cache;
+            for (j = 0; (j < leaf_num) && (leaves[j].leaf != CPUID_STANDARD_1_MASK); j++)
+                ;
+            if (j == leaf_num)
+            {
+                leaves[leaf_num].leaf = CPUID_STANDARD_1_MASK;
+                leaves[leaf_num++].subleaf = 0;
+            }
         }
 
-        kilo_size = ((edx >> 18) & 0x3FFF) * 512;
-        if (kilo_size)
+        for (j = 0; j < leaf_num; j++)
+        {
+            if ((leaves[j].leaf == feature->leaf) && (leaves[j].subleaf == feature->subleaf))
+            {
+                break;
+            }
+        }
+        if (j == leaf_num)
         {
-            mega_size = kilo_size / 1024;
+            leaves[leaf_num].leaf = feature->leaf;
+            leaves[leaf_num++].subleaf = feature->subleaf;
+        }
+    }
+    qsort(leaves, leaf_num, sizeof(leaves[0]), compare_cpuid_leaf);
 
-            if (mega_size)
+    /* leaf 0 gives both the highest standard leaf and the vendor */
+    regs = cpuid_table_add(table, 0, 0);
+    max_standard = regs[CPUID_EAX];
+    for (i = 0; i < leaf_num; i++)
+    {
+        if (leaves[i].leaf >= 0x80000000)
+        {
+            if (!max_extended)
             {
-                snprintf(amd_l3_cache, sizeof(amd_l3_cache), "%dM", mega_size);
+                regs = cpuid_table_add(table, 0x80000000, 0);
+                max_extended = regs[CPUID_EAX];
             }
-            else
+            if (leaves[i].leaf > max_extended)
             {
-                snprintf(amd_l3_cache, sizeof(amd_l3_cache), "%dK", kilo_size);
+                continue;
             }
-            x86_info->l3_cache = amd_l3_cache;
         }
+        else if (leaves[i].leaf > max_standard)
+        {
+            continue;
+        }
+        cpuid_table_add(table, leaves[i].leaf, leaves[i].subleaf);
     }
+    capture_xcr0(table);
+    return;
+}
+#endif
 
-    if (is_amd_cpu(x86_info->vendor))
+/*
+ * spec is a comma separated feature list, optionally followed by
+ * colon separated alternatives. Returns 0 if any alternative is fully
+ * supported, printing it when there was a choice, and 1 otherwise.
+ */
+static int check_x86_features(const char *spec)
+{
+    int i = 0, id_num = 0, alt_num = 0, vendor_id = X86_VENDOR_UNKNOWN;
+    int ids[CHECK_MAX_FEATURES], alt_end[CHECK_MAX_FEATURES];
+    const char *p = spec, *alt_start[CHECK_MAX_FEATURES];
+    char vendor[13];
+    const uint32_t *regs = NULL;
+    cpuid_table table;
+
+    /* an empty spec or element would make an alternative trivially supported */
+    if (!*spec)
+    {
+        errx(2, "no features given");
+    }
+    alt_start[0] = spec;
+    for (;;)
     {
-        if (x86_info->extended_mask & (1 << CPUID_EXTENDED_8_MASK))
+        size_t len = strcspn(p, ",:");
+
+        if (!len)
         {
-            __cpuid(0x80000000 | CPUID_EXTENDED_8_MASK, eax, ebx, ecx, edx);
-            x86_info->cores_per_socket = (ecx & 0xFF) + 1;
+            errx(2, "empty feature in: %s", spec);
         }
-	else
-	{
-	    /* fall back to standard CPUID leaf 1 on old processors */
-	    __cpuid(0x00000001, eax, ebx, ecx, edx);
-	    x86_info->cores_per_socket = (ebx >> 16) & 0xFF;
-	}
-
-        if (x86_info->extended_mask & (1 << CPUID_EXTENDED_1E_MASK))
+        if (id_num == CHECK_MAX_FEATURES)
         {
-            __cpuid(0x80000000 | CPUID_EXTENDED_1E_MASK, eax, ebx, ecx, edx);
-            x86_info->threads_per_core = ((ebx >> 8) & 0xFF) + 1;
-
-            if (x86_info->threads_per_core)
+            errx(2, "too many features");
+        }
+        if ((ids[id_num++] = find_x86_feature(p, len)) == -1)
+        {
+            errx(2, "unknown feature: %.*s", (int)len, p);
+        }
+        p += len;
+        if (!*p)
+        {
+            break;
+        }
+        if (*p == ':')
+        {
+            if (alt_num == CHECK_MAX_FEATURES - 1)
             {
-                x86_info->cores_per_socket = x86_info->cores_per_socket / x86_info->threads_per_core;
+                errx(2, "too many alternatives");
             }
-	}
+            alt_end[alt_num++] = id_num;
+            alt_start[alt_num] = p + 1;
+        }
+        p++;
+    }
+    alt_end[alt_num++] = id_num;
+
+#if defined(__amd64__) || defined(__i386__)
+    table.count = 0;
+    capture_cpuid_features(&table, ids, id_num);
+#else
+    errx(2, "feature checks need an x86 CPU");
+#endif
+
+    regs = cpuid_table_regs(&table, CPUID_STANDARD_0_MASK, 0);
+    memcpy(vendor, &regs[CPUID_EBX], 4);
+    memcpy(&vendor[4], &regs[CPUID_EDX], 4);
+    memcpy(&vendor[8], &regs[CPUID_ECX], 4);
+    vendor[12] = '\0';
+    if (is_intel_cpu(vendor))
+    {
+        vendor_id = X86_VENDOR_INTEL;
+    }
+    else if (is_amd_cpu(vendor))
+    {
+        vendor_id = X86_VENDOR_AMD;
     }
-    
-    /* Remove last space */
-    if (flag_len && (x86_info->flags[flag_len - 1] == ' '))
+
+    for (i = 0; i < alt_num; i++)
     {
-        x86_info->flags[flag_len - 1] = '\0';
+        int j = i ? alt_end[i - 1] : 0;
+
+        while ((j < alt_end[i]) && x86_feature_present(&table, vendor_id, ids[j]))
+        {
+            j++;
+        }
+        if (j == alt_end[i])
+        {
+            if (alt_num > 1)
+            {
+                printf("%.*s\n", (int)strcspn(alt_start[i], ":"), alt_start[i]);
+            }
+            return 0;
+        }
     }
+    return 1;
+}
+
+#if defined(__amd64__) || defined(__i386__)
+static void cpuid_exec(cpuid_table *table, uint32_t leaf, uint32_t subleaf, uint32_t *regs)
+{
+    __cpuid_count(leaf, subleaf, regs[CPUID_EAX], regs[CPUID_EBX], regs[CPUID_ECX], regs[CPUID_EDX]);
+    table->exec_count++;
     return;
 }
-#endif
 
-static void usage(void)
+static const uint32_t *cpuid_table_add(cpuid_table *table, uint32_t leaf, uint32_t subleaf)
 {
-    fprintf(stderr, "usage: lscpu [-h|--help]\n");
-    exit(1);
+    cpuid_leaf *entry = NULL;
+
+    if (table->count == CPUID_MAX_LEAVES)
+    {
+        return NULL;
+    }
+
+    entry = &table->leaves[table->count++];
+    entry->leaf = leaf;
+    entry->subleaf = subleaf;
+    cpuid_exec(table, leaf, subleaf, entry->regs);
+    return entry->regs;
 }
 
-static void print_cpu_info(gen_cpu_info *gen_info, x86_cpu_info *x86_info)
+/* Capture a leaf and all of its valid subleaves */
+static void capture_cpuid_leaf(cpuid_table *table, uint32_t leaf)
 {
-    printf("%-24s %s\n", "Architecture:", gen_info->arch);
-    printf("%-24s %s\n", "Byte Order:", gen_info->byte_order == 1234 ? "Little Endian" : "Big Endian");
-#ifdef __OpenBSD__
-    printf("%-24s %d\n", "Active CPU(s):", gen_info->active_cpu_num);
-    printf("%-24s %d\n", "Total CPU(s):", gen_info->total_cpu_num);
-#else /* Other BSDs */
-    printf("%-24s %d\n", "Total CPU(s):", gen_info->active_cpu_num);
-#endif
+    uint32_t subleaf = 0, max_subleaf = 0;
+    const uint32_t *regs = NULL, *regs1 = NULL;
 
-#if defined(__amd64__) || defined(__i386__)
-    if (x86_info->threads_per_core)
+    regs = cpuid_table_add(table, leaf, 0);
+    if (!regs)
     {
-        printf("%-24s %d\n", "Thread(s) per core:", x86_info->threads_per_core);
+        return;
     }
 
-    if (x86_info->cores_per_socket)
+    switch (leaf)
     {
-        printf("%-24s %d\n", "Core(s) per socket:", x86_info->cores_per_socket);
+        /* deterministic cache parameters, terminated by a null cache type */
+        case CPUID_STANDARD_4_MASK:
+        case 0x80000000 | CPUID_EXTENDED_1D_MASK:
+        {
+            for (subleaf = 1; (regs[CPUID_EAX] & 0x1F) && (subleaf < CPUID_MAX_SUBLEAVES); subleaf++)
+            {
+                if (!(regs = cpuid_table_add(table, leaf, subleaf)))
+                {
+                    break;
+                }
+            }
+            break;
+        }
+        /* topology levels, terminated by an invalid level type */
+        case CPUID_STANDARD_B_MASK:
+        case CPUID_STANDARD_1F_MASK:
+        {
+            for (subleaf = 1; ((regs[CPUID_ECX] >> 8) & 0xFF) && (subleaf < CPUID_MAX_SUBLEAVES); subleaf++)
+            {
+                if (!(regs = cpuid_table_add(table, leaf, subleaf)))
+                {
+                    break;
+                }
+            }
+            break;
+        }
+        /* subleaf 0 eax holds the highest valid subleaf */
+        case CPUID_STANDARD_7_MASK:
+        case 0x14:
+        case 0x17:
+        case 0x18:
+        case 0x1D:
+        case 0x20:
+        {
+            max_subleaf = MIN(regs[CPUID_EAX], CPUID_MAX_SUBLEAVES - 1);
+            for (subleaf = 1; subleaf <= max_subleaf; subleaf++)
+            {
+                cpuid_table_add(table, leaf, subleaf);
+            }
+            break;
+        }
+        /* XSAVE components, one subleaf per supported XCR0/XSS bit */
+        case CPUID_STANDARD_D_MASK:
+        {
+            uint64_t components = 0;
+
+            regs1 = cpuid_table_add(table, leaf, 1);
+            components = ((uint64_t)regs[CPUID_EDX] << 32) | regs[CPUID_EAX];
+            if (regs1)
+            {
+                components |= ((uint64_t)regs1[CPUID_EDX] << 32) | regs1[CPUID_ECX];
+            }
+            for (subleaf = 2; subleaf < 63; subleaf++)
+            {
+                if (components & (1ULL << subleaf))
+                {
+                    cpuid_table_add(table, leaf, subleaf);
+                }
+            }
+            break;
+        }
+        /* RDT monitoring and allocation resources */
+        case 0x0F:
+        case 0x10:
+        {
+            max_subleaf = (leaf == 0x0F) ? 1 : 3;
+            for (subleaf = 1; subleaf <= max_subleaf; subleaf++)
+            {
+                cpuid_table_add(table, leaf, subleaf);
+            }
+            break;
+        }
+        /* SGX, EPC sections are terminated by an invalid subleaf type */
+        case 0x12:
+        {
+            cpuid_table_add(table, leaf, 1);
+            for (subleaf = 2; subleaf < CPUID_MAX_SUBLEAVES; subleaf++)
+            {
+                regs = cpuid_table_add(table, leaf, subleaf);
+                if (!regs || !(regs[CPUID_EAX] & 0xF))
+                {
+                    break;
+                }
+            }
+            break;
+        }
+        default:
+        {
+            break;
+        }
     }
+    return;
+}
+
+/* Capture leaves base..max, where base returns max in eax */
+static void capture_cpuid_range(cpuid_table *table, uint32_t base, uint32_t limit)
+{
+    uint32_t leaf = 0, max_leaf = 0;
+    const uint32_t *regs = NULL;
 
-    if ((x86_info->threads_per_core) && (x86_info->cores_per_socket))
+    regs = cpuid_table_add(table, base, 0);
+    if (!regs)
     {
-#ifdef __OpenBSD__
-        int total_cpu_num = gen_info->total_cpu_num;
-#else /* Other BSDs */
-        int total_cpu_num = gen_info->active_cpu_num;
-#endif
-        printf("%-24s %d\n", "Socket(s):", total_cpu_num / ((x86_info->threads_per_core) * (x86_info->cores_per_socket)));
+        return;
     }
 
-    if (x86_cpu_support_standard_flag(x86_info->standard_mask, CPUID_STANDARD_0_MASK))
+    max_leaf = regs[CPUID_EAX];
+    if ((base == 0x40000000) && !max_leaf)
     {
-        printf("%-24s %s\n", "Vendor:", x86_info->vendor);
+        /* older KVM hosts report 0, which means 0x40000001 */
+        max_leaf = base + 1;
     }
-    else
+    if (base && ((max_leaf < base) || (max_leaf > base + 0xFFFF)))
     {
-#ifdef __OpenBSD__
-        printf("%-24s %s\n", "Vendor:", gen_info->vendor);
-#endif
+        /* range not implemented, the answer is junk from another leaf */
+        table->count--;
+        return;
     }
 
-    if (x86_cpu_support_standard_flag(x86_info->standard_mask, CPUID_STANDARD_1_MASK))
+    max_leaf = MIN(max_leaf, base + limit);
+    for (leaf = base + 1; leaf <= max_leaf; leaf++)
     {
-        printf("%-24s %d\n", "CPU family:", x86_info->family);
-        printf("%-24s %d\n", "Model:", x86_info->model);
-    }
-    printf("%-24s %s\n", "Model name:", gen_info->model);
-    if (x86_cpu_support_standard_flag(x86_info->standard_mask, CPUID_STANDARD_1_MASK))
-    {   
-        printf("%-24s %d\n", "Stepping:", x86_info->stepping);
+        capture_cpuid_leaf(table, leaf);
     }
+    return;
+}
 
-#ifdef __OpenBSD__
-    printf("%-24s %d\n", "CPU MHz:", gen_info->speed);
-#endif
+/* Read XCR0 after the capture; leaf 1 comes from the table, not another CPUID */
+static void capture_xcr0(cpuid_table *table)
+{
+    const uint32_t *regs = cpuid_table_regs(table, CPUID_STANDARD_1_MASK, 0);
+    uint32_t eax = 0, edx = 0;
 
-    if (x86_info->l1d_cache)
-    {
-        printf("%-24s %s\n", "L1d cache:", x86_info->l1d_cache);
-    }
-    if (x86_info->l1i_cache)
-    {
-        printf("%-24s %s\n", "L1i cache:", x86_info->l1i_cache);
-    }
-    if (x86_info->l2_cache)
+    if (!regs)
     {
-        printf("%-24s %s\n", "L2 cache:", x86_info->l2_cache);
+        return;
     }
-    if (x86_info->l3_cache)
+    /* xgetbv is #UD until the OS sets CR4.OSXSAVE */
+    if (regs[CPUID_ECX] & (1U << 27))
     {
-        printf("%-24s %s\n", "L3 cache:", x86_info->l3_cache);
+        __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
     }
+    table->xcr0 = ((uint64_t)edx << 32) | eax;
+    table->xcr0_valid = 1;
+    return;
+}
+
+/*
+ * Execute every supported CPUID leaf exactly once, in ascending order so
+ * cpuid_table_regs() can binary search. Under a hypervisor each CPUID is a
+ * VM exit, so the decoders must never execute CPUID themselves.
+ */
+static void capture_cpuid_table(cpuid_table *table)
+{
+    struct timespec start, end;
+    const uint32_t *regs = NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    capture_cpuid_range(table, 0, CPUID_CAPTURE_STANDARD_LIMIT);
 
-    if (x86_info->flags[0])
+    /* the hypervisor range is only defined when leaf 1 says we're a guest */
+    regs = cpuid_table_regs(table, CPUID_STANDARD_1_MASK, 0);
+    if (regs && (regs[CPUID_ECX] & 0x80000000))
     {
-        printf("%-24s %s\n", "Flags:", x86_info->flags);
+        capture_cpuid_range(table, 0x40000000, CPUID_CAPTURE_HYPERVISOR_LIMIT);
     }
-#else /* Other architectures */
-    printf("%-24s %s\n", "Model name:", gen_info->model);
-#ifdef __OpenBSD__
-    printf("%-24s %d\n", "CPU MHz:", gen_info->speed);
-#endif
-#endif
 
+    capture_cpuid_range(table, 0x80000000, CPUID_CAPTURE_EXTENDED_LIMIT);
+    capture_xcr0(table);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    table->exec_nsec = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000 + end.tv_nsec - start.tv_nsec;
     return;
 }
+#endif
 
-int main(int argc, char **argv) 
+static const uint32_t *cpuid_table_regs(const cpuid_table *table, uint32_t leaf, uint32_t subleaf)
 {
-    int mib[2], ch = 0, i = 0;
-
-    struct option longopts[] = {
-        {"help", no_argument, NULL, 'h'},
-        {NULL, 0, NULL, 0}
-    };
-
-    sysctl_get_cpu_info sysctl_array[] = {
-#ifdef __FreeBSD__
-        {HW_MACHINE_ARCH, gen_info.arch, sizeof(gen_info.arch), "HW_MACHINE_ARCH"},
-#else
-        {HW_MACHINE, gen_info.arch, sizeof(gen_info.arch), "HW_MACHINE"},
-#endif
-        {HW_BYTEORDER, &(gen_info.byte_order), sizeof(gen_info.byte_order), "HW_BYTEORDER"},
-        {HW_MODEL, gen_info.model, sizeof(gen_info.model), "HW_MODEL"},
-        {HW_NCPU, &(gen_info.active_cpu_num), sizeof(gen_info.active_cpu_num), "HW_NCPU"},
-#ifdef __OpenBSD__
-        {HW_VENDOR, gen_info.vendor, sizeof(gen_info.vendor), "HW_VENDOR"},
-        {HW_NCPUFOUND, &(gen_info.total_cpu_num), sizeof(gen_info.total_cpu_num), "HW_NCPUFOUND"},
-        {HW_CPUSPEED, &(gen_info.speed), sizeof(gen_info.speed), "HW_CPUSPEED"},
-#endif
-    };
+    int low = 0, high = table->count - 1;
 
-    while ((ch = getopt_long(argc, argv, "h", longopts, NULL)) != -1) 
+    while (low <= high)
     {
-        switch (ch)
+        int mid = low + (high - low) / 2;
+        const cpuid_leaf *entry = &table->leaves[mid];
+
+        if ((entry->leaf == leaf) && (entry->subleaf == subleaf))
         {
-            case 'h':
-            case '?':
-            default:
-            {
-                usage();
-            }
+            return entry->regs;
+        }
+        if ((entry->leaf < leaf) || ((entry->leaf == leaf) && (entry->subleaf < subleaf)))
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid - 1;
         }
     }
+    return NULL;
+}
 
-    argc -= optind;
-    argv += optind;
+static int ceil_log2(uint32_t value)
+{
+    int bits = 0;
 
-    if (argc)
+    while ((bits < 32) && ((1ULL << bits) < value))
     {
-        usage();
+        bits++;
     }
+    return bits;
+}
 
-    for (i = 0; i < ARRAY_LEN(sysctl_array); i++)
+/*
+ * The x2APIC ID is split into SMT, core, module, die and package fields;
+ * each shift is where the next level's field starts. Intel reports the
+ * widths in leaf 0x1F (or 0xB), AMD in 0x8000001E and 0x80000008.
+ */
+static void decode_x86_topology(const cpuid_table *table, x86_cpu_info *x86_info)
+{
+    int subleaf = 0;
+    uint32_t leaf = CPUID_STANDARD_1F_MASK;
+    uint8_t shifts[8] = {0};
+    x86_topology *topology = &x86_info->topology;
+    const uint32_t *regs = NULL;
+
+    if (x86_info->vendor_id == X86_VENDOR_AMD)
     {
-        mib[0] = CTL_HW;
-        mib[1] = sysctl_array[i].mib_code;
-        if (sysctl(mib, ARRAY_LEN(mib), sysctl_array[i].old, &sysctl_array[i].old_len, NULL, 0) == -1)
+        topology->smt_shift = ceil_log2(x86_info->threads_per_core);
+        if ((regs = cpuid_table_regs(table, 0x80000000 | CPUID_EXTENDED_8_MASK, 0)))
         {
-            if (errno == EOPNOTSUPP)
+            topology->package_shift = (regs[CPUID_ECX] >> 12) & 0xF;
+            if (!topology->package_shift)
             {
-                continue;
+                topology->package_shift = ceil_log2((regs[CPUID_ECX] & 0xFF) + 1);
             }
-            err(1, "%s", sysctl_array[i].err_msg);
         }
+        topology->core_shift = topology->package_shift;
+        topology->module_shift = topology->package_shift;
+        topology->die_shift = topology->package_shift;
+        return;
     }
 
-#if defined(__amd64__) || defined(__i386__)
-    get_x86_cpu_info(&x86_info);
-#endif
+    /* leaf 0x1F is only valid when its first subleaf reports a nonzero EBX */
+    regs = cpuid_table_regs(table, CPUID_STANDARD_1F_MASK, 0);
+    if (!regs || !regs[CPUID_EBX])
+    {
+        leaf = CPUID_STANDARD_B_MASK;
+        if (!cpuid_table_regs(table, CPUID_STANDARD_B_MASK, 0))
+        {
+            /* pre-x2APIC: leaf 1 gives the IDs per package, leaf 4 the cores */
+            uint32_t ids = 1, cores = 1;
 
-    print_cpu_info(&gen_info, &x86_info);
+            if ((regs = cpuid_table_regs(table, CPUID_STANDARD_1_MASK, 0)) && ((regs[CPUID_EDX] >> 28) & 1))
+            {
+                ids = (regs[CPUID_EBX] >> 16) & 0xFF;
+            }
+            if ((regs = cpuid_table_regs(table, CPUID_STANDARD_4_MASK, 0)))
+            {
+                cores = ((regs[CPUID_EAX] >> 26) & 0x3F) + 1;
+            }
+            topology->package_shift = ceil_log2(ids);
+            topology->smt_shift = ceil_log2(ids / cores);
+            topology->core_shift = topology->package_shift;
+            topology->module_shift = topology->package_shift;
+            topology->die_shift = topology->package_shift;
+            return;
+        }
+    }
+
+    for (subleaf = 0; subleaf < CPUID_MAX_SUBLEAVES; subleaf++)
+    {
+        int level_type = 0;
+
+        regs = cpuid_table_regs(table, leaf, subleaf);
+        if (!regs || !((regs[CPUID_ECX] >> 8) & 0xFF))
+        {
+            break;
+        }
+
+        /* 1 SMT, 2 core, 3 module, 4 tile, 5 die, 6 die group */
+        level_type = (regs[CPUID_ECX] >> 8) & 0xFF;
+        if (level_type < ARRAY_LEN(shifts))
+        {
+            shifts[level_type] = regs[CPUID_EAX] & 0x1F;
+        }
+        topology->package_shift = regs[CPUID_EAX] & 0x1F;
+    }
+
+    /* a missing level takes the width of the one below it */
+    topology->smt_shift = shifts[1];
+    topology->core_shift = MAX(shifts[2], topology->smt_shift);
+    topology->module_shift = MAX(MAX(shifts[3], shifts[4]), topology->core_shift);
+    topology->die_shift = MAX(MAX(shifts[5], shifts[6]), topology->module_shift);
+    topology->package_shift = MAX(topology->package_shift, topology->die_shift);
+    return;
+}
+
+static void decode_x86_cpu_info(const cpuid_table *table, x86_cpu_info *x86_info)
+{
+    int i = 0, intel = 0, id = 0;
+    uint32_t eax;
+    const uint32_t *regs = NULL;
+
+    regs = cpuid_table_regs(table, CPUID_STANDARD_0_MASK, 0);
+    if (!regs)
+    {
+        return;
+    }
+    memcpy(x86_info->vendor, &regs[CPUID_EBX], sizeof(regs[CPUID_EBX]));
+    memcpy(&(x86_info->vendor[4]), &regs[CPUID_EDX], sizeof(regs[CPUID_EDX]));
+    memcpy(&(x86_info->vendor[8]), &regs[CPUID_ECX], sizeof(regs[CPUID_ECX]));
+    for (i = 0; (i <= regs[CPUID_EAX]) && (i <= CPUID_MAX_STANDARD_FUNCTION); i++)
+    {
+        x86_info->standard_mask |= (1 << i);
+    }
+
+    /* compare the vendor string once, not at every step */
+    if (is_intel_cpu(x86_info->vendor))
+    {
+        x86_info->vendor_id = X86_VENDOR_INTEL;
+    }
+    else if (is_amd_cpu(x86_info->vendor))
+    {
+        x86_info->vendor_id = X86_VENDOR_AMD;
+    }
+    intel = (x86_info->vendor_id == X86_VENDOR_INTEL);
+
+    regs = cpuid_table_regs(table, 0x80000000, 0);
+    if (regs)
+    {
+        eax = regs[CPUID_EAX] & ~0x80000000;
+        for (i = 0; (i <= eax) && (i <= CPUID_MAX_EXTENDED_FUNCTION); i++)
+        {
+            x86_info->extended_mask |= (1 << i);
+        }
+    }
+
+    regs = cpuid_table_regs(table, CPUID_STANDARD_1_MASK, 0);
+    if (regs)
+    {
+        eax = regs[CPUID_EAX];
+        x86_info->stepping = eax & 0xF;
+        x86_info->family = (eax >> 8) & 0xF;
+        x86_info->model = (eax >> 4) & 0xF;
+        if ((x86_info->family == 6) || (x86_info->family == 15))
+        {
+            x86_info->model |= (eax >> 12) & 0xF0;
+            if (x86_info->family == 15)
+            {
+                x86_info->family += (eax >> 20) & 0xFF;
+            }
+        }
+    }
+
+    id = timing_begin(intel ? "leaf 4 caches" : "cache leaves", 2);
+    decode_x86_caches(table, x86_info);
+    timing_end(id);
+
+    /* the leaf 2 descriptors only matter when leaf 4 is missing */
+    regs = cpuid_table_regs(table, CPUID_STANDARD_2_MASK, 0);
+    if (intel && regs && !x86_info->cache_num)
+    {
+        id = timing_begin("leaf 2 descriptors", 2);
+        for (i = 0; i < 4; i++)
+        {
+            if (!(regs[i] & 0x80000000))
+            {
+                /* the low byte of eax is the iteration count, not a descriptor */
+                if (i)
+                {
+                    parse_intel_cache_value(x86_info, regs[i] & 0xFF);
+                }
+                parse_intel_cache_value(x86_info, (regs[i] >> 8) & (0xFF));
+                parse_intel_cache_value(x86_info, (regs[i] >> 16) & (0xFF));
+                parse_intel_cache_value(x86_info, (regs[i] >> 24) & (0xFF));
+            }
+        }
+        timing_end(id);
+    }
+
+    if (intel && cpuid_table_regs(table, CPUID_STANDARD_B_MASK, 0))
+    {
+        int subleaf = 0;
+
+        id = timing_begin("leaf 0xB loop", 2);
+        for (subleaf = 0; (regs = cpuid_table_regs(table, CPUID_STANDARD_B_MASK, subleaf)); subleaf++)
+        {
+            int level_type = 0;
+            
+            if (!regs[CPUID_EAX] && !regs[CPUID_EBX])
+            {
+                break;
+            }
+
+            level_type = (regs[CPUID_ECX] >> 8) & 0xFF;
+            if (level_type == 1)
+            {
+                x86_info->threads_per_core = regs[CPUID_EBX];
+            }
+            else if (level_type == 2)
+            {
+                x86_info->cores_per_socket = regs[CPUID_EBX];
+            }
+        }
+
+        if (x86_info->threads_per_core)
+        {
+            x86_info->cores_per_socket = x86_info->cores_per_socket / x86_info->threads_per_core;
+        }
+        timing_end(id);
+    }
+
+    if (x86_info->vendor_id == X86_VENDOR_AMD)
+    {
+        id = timing_begin("AMD core leaves", 2);
+        if ((regs = cpuid_table_regs(table, 0x80000000 | CPUID_EXTENDED_8_MASK, 0)))
+        {
+            x86_info->cores_per_socket = (regs[CPUID_ECX] & 0xFF) + 1;
+        }
+        else if ((regs = cpuid_table_regs(table, CPUID_STANDARD_1_MASK, 0)))
+        {
+            /* fall back to standard CPUID leaf 1 on old processors */
+            x86_info->cores_per_socket = (regs[CPUID_EBX] >> 16) & 0xFF;
+        }
+
+        if ((regs = cpuid_table_regs(table, 0x80000000 | CPUID_EXTENDED_1E_MASK, 0)))
+        {
+            x86_info->threads_per_core = ((regs[CPUID_EBX] >> 8) & 0xFF) + 1;
+
+            if (x86_info->threads_per_core)
+            {
+                x86_info->cores_per_socket = x86_info->cores_per_socket / x86_info->threads_per_core;
+            }
+        }
+        timing_end(id);
+    }
+
+    id = timing_begin("topology", 2);
+    decode_x86_topology(table, x86_info);
+    timing_end(id);
+    id = timing_begin("features", 2);
+    decode_x86_features(table, x86_info);
+    timing_end(id);
+    return;
+}
+
+#if defined(__amd64__) || defined(__i386__)
+static void get_x86_cpu_info(x86_cpu_info *x86_info)
+{
+    int id = timing_begin("cpuid capture", 1);
+
+    capture_cpuid_table(&cpuid_raw);
+    timing_end(id);
+    id = timing_begin("decode", 1);
+    decode_x86_cpu_info(&cpuid_raw, x86_info);
+    timing_end(id);
+    return;
+}
+
+/* Must run on the CPU being described, see percpu_worker() */
+static void get_x86_percpu_info(percpu_info *info)
+{
+    uint32_t eax, ebx, ecx, edx, max_leaf, max_extended;
+
+    __cpuid(0, max_leaf, ebx, ecx, edx);
+    __cpuid(0x80000000, max_extended, ebx, ecx, edx);
+
+    __cpuid(CPUID_STANDARD_1_MASK, eax, ebx, ecx, edx);
+    info->signature = eax;
+    info->apic_id = (ebx >> 24) & 0xFF;
+    info->x2apic_id = info->apic_id;
+    info->features[0] = ecx;
+    info->features[1] = edx;
+
+    if (max_leaf >= CPUID_STANDARD_7_MASK)
+    {
+        __cpuid_count(CPUID_STANDARD_7_MASK, 0, eax, ebx, ecx, edx);
+        info->features[2] = ebx;
+        info->features[3] = ecx;
+        info->features[4] = edx;
+    }
+
+    if (max_leaf >= CPUID_STANDARD_B_MASK)
+    {
+        __cpuid_count(CPUID_STANDARD_B_MASK, 0, eax, ebx, ecx, edx);
+        if (eax || ebx)
+        {
+            info->x2apic_id = edx;
+        }
+    }
+
+    /* hybrid parts (e.g. Alder Lake) report the core type in leaf 0x1A */
+    if (max_leaf >= 0x1A)
+    {
+        __cpuid_count(0x1A, 0, eax, ebx, ecx, edx);
+        info->hybrid_info = eax;
+    }
+
+    if (max_extended >= (0x80000000 | CPUID_EXTENDED_1E_MASK))
+    {
+        __cpuid(0x80000000 | CPUID_EXTENDED_1E_MASK, info->amd_topology[CPUID_EAX], info->amd_topology[CPUID_EBX],
+                info->amd_topology[CPUID_ECX], info->amd_topology[CPUID_EDX]);
+    }
+    return;
+}
+#endif
+
+#ifdef __linux__
+/* One read(2) into the caller's buffer, sysfs files are far below a page */
+static int read_small_file(const char *path, char *buf, size_t len)
+{
+    int fd = -1;
+    ssize_t n = 0;
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+    {
+        return -1;
+    }
+    n = read(fd, buf, len - 1);
+    close(fd);
+    if (n < 0)
+    {
+        return -1;
+    }
+    buf[n] = '\0';
+    return (int)n;
+}
+
+/* Count the CPUs in a kernel CPU list such as "0-3,8,10-11" */
+static int count_cpu_list(const char *list)
+{
+    int count = 0;
+    long first = 0, last = 0;
+    char *end = NULL;
+
+    while (*list && (*list != '\n'))
+    {
+        first = last = strtol(list, &end, 10);
+        if (end == list)
+        {
+            break;
+        }
+        if (*end == '-')
+        {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list)
+            {
+                break;
+            }
+        }
+        count += last - first + 1;
+        list = end + (*end == ',');
+    }
+    return count;
+}
+
+/*
+ * /proc/cpuinfo is avoided on purpose: reading it makes the kernel sample
+ * APERF/MPERF on every CPU through IPIs and formats a block per CPU. The
+ * model name is taken from the CPUID brand string once it's captured.
+ */
+static int linux_get_gen_info(gen_cpu_info *gen_info)
+{
+    char buf[CPU_LIST_LEN];
+    struct utsname name;
+
+    if (uname(&name) == -1)
+    {
+        return -1;
+    }
+    snprintf(gen_info->arch, sizeof(gen_info->arch), "%.*s", (int)sizeof(gen_info->arch) - 1, name.machine);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    gen_info->byte_order = 1234;
+#else
+    gen_info->byte_order = 4321;
+#endif
+
+    if (read_small_file("/sys/devices/system/cpu/online", buf, sizeof(buf)) > 0)
+    {
+        gen_info->active_cpu_num = count_cpu_list(buf);
+    }
+    if (read_small_file("/sys/devices/system/cpu/present", buf, sizeof(buf)) > 0)
+    {
+        gen_info->total_cpu_num = count_cpu_list(buf);
+    }
+    if (read_small_file("/sys/devices/system/cpu/possible", buf, sizeof(buf)) > 0)
+    {
+        gen_info->possible_cpu_num = count_cpu_list(buf);
+    }
+    if (read_small_file("/sys/devices/system/node/online", buf, sizeof(buf)) > 0)
+    {
+        gen_info->numa_node_num = count_cpu_list(buf);
+    }
+
+    /* sysfs may not be mounted in a container */
+    if (!gen_info->active_cpu_num)
+    {
+        gen_info->active_cpu_num = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (!gen_info->total_cpu_num)
+    {
+        gen_info->total_cpu_num = gen_info->active_cpu_num;
+    }
+    return 0;
+}
+
+/* Find this process's cgroup in /proc/self/cgroup, a NULL controller means the v2 hierarchy */
+static int read_cgroup_path(const char *controller, char *path, size_t len)
+{
+    char buf[CPU_LIST_LEN];
+    char *line = NULL, *next = NULL, *list = NULL, *name = NULL, *rest = NULL;
+    size_t n = 0;
+
+    if (read_small_file("/proc/self/cgroup", buf, sizeof(buf)) <= 0)
+    {
+        return -1;
+    }
+    for (line = buf; line && *line; line = next)
+    {
+        if ((next = strchr(line, '\n')))
+        {
+            *next++ = '\0';
+        }
+        /* hierarchy-ID:controller-list:path */
+        if (!(list = strchr(line, ':')) || !(rest = strchr(++list, ':')))
+        {
+            continue;
+        }
+        *rest++ = '\0';
+        if (!controller)
+        {
+            if (strcmp(line, "0:") || *list)
+            {
+                continue;
+            }
+        }
+        else
+        {
+            for (name = strtok(list, ","); name && strcmp(name, controller); name = strtok(NULL, ","))
+                ;
+            if (!name)
+            {
+                continue;
+            }
+        }
+        /* the root is kept as "" so that the paths below are root + path */
+        n = strlen(rest);
+        if (n && (rest[n - 1] == '/'))
+        {
+            rest[--n] = '\0';
+        }
+        snprintf(path, len, "%s", rest);
+        return 0;
+    }
+    return -1;
+}
+
+/*
+ * Without a cgroup namespace a container still sees the host's path in
+ * /proc/self/cgroup, while its own cgroup is mounted as the root.
+ */
+static void resolve_cgroup_path(const char *root, char *path)
+{
+    char dir[PATH_MAX];
+
+    snprintf(dir, sizeof(dir), "%s%s", root, path);
+    if (access(dir, F_OK) == -1)
+    {
+        path[0] = '\0';
+    }
+    return;
+}
+
+/* A limit anywhere up the hierarchy applies, so keep the tightest one */
+static void read_cfs_quota(const char *root, char *path, int version, cgroup_cpu_limits *limits)
+{
+    char file[PATH_MAX], buf[64];
+    char *slash = NULL;
+    long quota = 0, period = 0;
+
+    for (;;)
+    {
+        quota = period = 0;
+        if (version == 2)
+        {
+            snprintf(file, sizeof(file), "%s%s/cpu.max", root, path);
+            if ((read_small_file(file, buf, sizeof(buf)) > 0) && (sscanf(buf, "%ld %ld", &quota, &period) != 2))
+            {
+                quota = 0; /* "max" */
+            }
+        }
+        else
+        {
+            snprintf(file, sizeof(file), "%s%s/cpu.cfs_quota_us", root, path);
+            if (read_small_file(file, buf, sizeof(buf)) > 0)
+            {
+                quota = strtol(buf, NULL, 10);
+            }
+            snprintf(file, sizeof(file), "%s%s/cpu.cfs_period_us", root, path);
+            if (read_small_file(file, buf, sizeof(buf)) > 0)
+            {
+                period = strtol(buf, NULL, 10);
+            }
+        }
+        if ((quota > 0) && (period > 0) &&
+                ((limits->quota < 0) || ((double)quota / period < (double)limits->quota / limits->period)))
+        {
+            limits->quota = quota;
+            limits->period = period;
+        }
+        if (!(slash = strrchr(path, '/')))
+        {
+            break;
+        }
+        *slash = '\0';
+    }
+    return;
+}
+
+static void get_cgroup_limits(cgroup_cpu_limits *limits)
+{
+    char path[PATH_MAX], file[PATH_MAX + 64];
+
+    memset(limits, 0, sizeof(*limits));
+    limits->quota = -1;
+
+    /* a hybrid setup mounts v2 at /sys/fs/cgroup/unified, but without the CPU controllers */
+    if ((access("/sys/fs/cgroup/cgroup.controllers", F_OK) == 0) && (read_cgroup_path(NULL, path, sizeof(path)) == 0))
+    {
+        limits->version = 2;
+        resolve_cgroup_path("/sys/fs/cgroup", path);
+        snprintf(file, sizeof(file), "/sys/fs/cgroup%s/cpuset.cpus.effective", path);
+        read_small_file(file, limits->cpuset, sizeof(limits->cpuset));
+        read_cfs_quota("/sys/fs/cgroup", path, 2, limits);
+        return;
+    }
+
+    if (read_cgroup_path("cpuset", path, sizeof(path)) == 0)
+    {
+        limits->version = 1;
+        resolve_cgroup_path("/sys/fs/cgroup/cpuset", path);
+        snprintf(file, sizeof(file), "/sys/fs/cgroup/cpuset%s/cpuset.effective_cpus", path);
+        read_small_file(file, limits->cpuset, sizeof(limits->cpuset));
+    }
+    if (read_cgroup_path("cpu", path, sizeof(path)) == 0)
+    {
+        limits->version = 1;
+        resolve_cgroup_path("/sys/fs/cgroup/cpu", path);
+        read_cfs_quota("/sys/fs/cgroup/cpu", path, 1, limits);
+    }
+    return;
+}
+
+/* Like count_cpu_list(), but skips the flags isolcpus= takes before its list */
+static void mark_cpu_list(const char *list, unsigned char *set, int max)
+{
+    long first = 0, last = 0;
+    char *end = NULL;
+
+    while (*list && !isspace((unsigned char)*list))
+    {
+        if (!isdigit((unsigned char)*list))
+        {
+            list += strcspn(list, ", \n");
+            list += (*list == ',');
+            continue;
+        }
+        first = last = strtol(list, &end, 10);
+        if (*end == '-')
+        {
+            last = strtol(end + 1, &end, 10);
+        }
+        for (; (first <= last) && (first < max); first++)
+        {
+            set[first] = 1;
+        }
+        list = end + (*end == ',');
+    }
+    return;
+}
+
+/*
+ * Read a CPU list from sysfs, or failing that from a kernel command line
+ * parameter. Returns -1 if neither is there, so absent isn't read as empty.
+ */
+static int read_cpu_set(const char *path, const char *param, unsigned char *set, int max)
+{
+    char buf[CPU_LIST_LEN];
+    char *value = NULL;
+    size_t n = param ? strlen(param) : 0;
+
+    memset(set, 0, max);
+    if (path && (read_small_file(path, buf, sizeof(buf)) >= 0))
+    {
+        mark_cpu_list(buf, set, max);
+        return 0;
+    }
+    if (!param || (read_small_file("/proc/cmdline", buf, sizeof(buf)) <= 0))
+    {
+        return -1;
+    }
+    for (value = buf; (value = strstr(value, param)); value += n)
+    {
+        if (((value == buf) || isspace((unsigned char)value[-1])) && (value[n] == '='))
+        {
+            mark_cpu_list(value + n + 1, set, max);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Count the sockets and cores from each online CPU's sysfs topology, so
+ * a plain run wakes none of them. die_id only exists since Linux 5.2.
+ */
+static int linux_get_topology(x86_cpu_info *x86_info)
+{
+    char path[PATH_MAX], buf[32];
+    unsigned char online[AFFINITY_MAX_CPUS];
+    percpu_info *table = NULL;
+    int i = 0, n = 0;
+
+    if (read_cpu_set("/sys/devices/system/cpu/online", NULL, online, AFFINITY_MAX_CPUS) == -1)
+    {
+        return -1;
+    }
+    if (!(table = calloc(AFFINITY_MAX_CPUS, sizeof(*table))))
+    {
+        return -1;
+    }
+    for (i = 0; i < AFFINITY_MAX_CPUS; i++)
+    {
+        if (!online[i])
+        {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", i);
+        if (read_small_file(path, buf, sizeof(buf)) <= 0)
+        {
+            continue;
+        }
+        table[n].package = (uint32_t)strtoul(buf, NULL, 10);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", i);
+        if (read_small_file(path, buf, sizeof(buf)) <= 0)
+        {
+            continue;
+        }
+        table[n].core = (uint32_t)strtoul(buf, NULL, 10);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/die_id", i);
+        if (read_small_file(path, buf, sizeof(buf)) > 0)
+        {
+            table[n].die = (uint32_t)strtoul(buf, NULL, 10);
+        }
+        table[n].cpu = i;
+        table[n].valid = 1;
+        n++;
+    }
+    if (n)
+    {
+        count_topology(table, n, x86_info);
+    }
+    free(table);
+    return n ? 0 : -1;
+}
+#else
+/* The entries of sysctl_array point into the global gen_info */
+static int bsd_get_gen_info(gen_cpu_info *gen_info)
+{
+    int mib[2], i = 0;
+
+    for (i = 0; i < ARRAY_LEN(sysctl_array); i++)
+    {
+        mib[0] = CTL_HW;
+        mib[1] = sysctl_array[i].mib_code;
+        if (sysctl(mib, ARRAY_LEN(mib), sysctl_array[i].old, &sysctl_array[i].old_len, NULL, 0) == -1)
+        {
+            if (errno == EOPNOTSUPP)
+            {
+                continue;
+            }
+            err(1, "%s", sysctl_array[i].err_msg);
+        }
+    }
+#ifdef __FreeBSD__
+    {
+        size_t len = sizeof(gen_info->numa_node_num);
+
+        if (sysctlbyname("vm.ndomains", &gen_info->numa_node_num, &len, NULL, 0) == -1)
+        {
+            gen_info->numa_node_num = 0;
+        }
+    }
+#endif
+    return 0;
+}
+#endif
+
+static sysctl_get_cpu_info *find_sysctl_entry(const char *name)
+{
+    int i = 0;
+
+    for (i = 0; i < ARRAY_LEN(sysctl_array); i++)
+    {
+        if (!strcmp(sysctl_array[i].err_msg, name))
+        {
+            return &sysctl_array[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * The leaves are written in the "cpuid -r" format so dumps taken with
+ * either tool can be replayed; the sysctl lines are ignored by cpuid.
+ */
+static int dump_cpu_info(const char *path, cpuid_table *table)
+{
+    int i = 0;
+    FILE *fp = stdout;
+
+    if (strcmp(path, "-") && !(fp = fopen(path, "w")))
+    {
+        return -1;
+    }
+
+    fprintf(fp, "# lscpu dump %d\n", DUMP_VERSION);
+    for (i = 0; i < ARRAY_LEN(sysctl_array); i++)
+    {
+        if (sysctl_array[i].is_string)
+        {
+            fprintf(fp, "sysctl %s %s\n", sysctl_array[i].err_msg, (char *)sysctl_array[i].old);
+        }
+        else
+        {
+            fprintf(fp, "sysctl %s %d\n", sysctl_array[i].err_msg, *(int *)sysctl_array[i].old);
+        }
+    }
+
+    if (table->xcr0_valid)
+    {
+        fprintf(fp, "xcr0 0x%016llx\n", (unsigned long long)table->xcr0);
+    }
+
+    fprintf(fp, "CPU 0:\n");
+    for (i = 0; i < table->count; i++)
+    {
+        cpuid_leaf *entry = &table->leaves[i];
+
+        fprintf(fp, "   0x%08x 0x%02x: eax=0x%08x ebx=0x%08x ecx=0x%08x edx=0x%08x\n",
+                entry->leaf, entry->subleaf,
+                entry->regs[CPUID_EAX], entry->regs[CPUID_EBX], entry->regs[CPUID_ECX], entry->regs[CPUID_EDX]);
+    }
+
+    if ((fp != stdout) && (fclose(fp) == EOF))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static int compare_cpuid_leaf(const void *a, const void *b)
+{
+    const cpuid_leaf *x = a, *y = b;
+
+    if (x->leaf != y->leaf)
+    {
+        return (x->leaf < y->leaf) ? -1 : 1;
+    }
+    if (x->subleaf != y->subleaf)
+    {
+        return (x->subleaf < y->subleaf) ? -1 : 1;
+    }
+    return 0;
+}
+
+/*
+ * Parse one "cpuid -r" leaf line into the table. Returns 1 if the line
+ * was a leaf, 0 otherwise.
+ */
+static int parse_cpuid_line(const char *line, cpuid_table *table)
+{
+    cpuid_leaf entry;
+    unsigned long long xcr0 = 0;
+
+    if (sscanf(line, "xcr0 0x%llx", &xcr0) == 1)
+    {
+        table->xcr0 = xcr0;
+        table->xcr0_valid = 1;
+        return 1;
+    }
+
+    if (sscanf(line, " 0x%x 0x%x: eax=0x%x ebx=0x%x ecx=0x%x edx=0x%x",
+                &entry.leaf, &entry.subleaf,
+                &entry.regs[CPUID_EAX], &entry.regs[CPUID_EBX], &entry.regs[CPUID_ECX], &entry.regs[CPUID_EDX]) != 6)
+    {
+        return 0;
+    }
+
+    if (table->count < CPUID_MAX_LEAVES)
+    {
+        table->leaves[table->count++] = entry;
+    }
+    return 1;
+}
+
+/* Load the first CPU of a dump; decoding it never executes CPUID */
+static int load_cpu_dump(const char *path, cpuid_table *table)
+{
+    int cpu_blocks = 0;
+    char line[512];
+    FILE *fp = stdin;
+
+    if (strcmp(path, "-") && !(fp = fopen(path, "r")))
+    {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (!strncmp(line, "CPU ", 4))
+        {
+            /* every CPU in a "cpuid -r" dump repeats the leaves, keep the first */
+            if (cpu_blocks++)
+            {
+                break;
+            }
+        }
+        else if (!strncmp(line, "sysctl ", 7))
+        {
+            char *name = line + 7, *value = NULL;
+            sysctl_get_cpu_info *entry = NULL;
+
+            line[strcspn(line, "\n")] = '\0';
+            value = strchr(name, ' ');
+            if (!value)
+            {
+                continue;
+            }
+            *value++ = '\0';
+
+            if (!(entry = find_sysctl_entry(name)))
+            {
+                continue;
+            }
+            if (entry->is_string)
+            {
+                snprintf(entry->old, entry->old_len, "%s", value);
+            }
+            else
+            {
+                *(int *)entry->old = (int)strtol(value, NULL, 0);
+            }
+        }
+        else
+        {
+            parse_cpuid_line(line, table);
+        }
+    }
+
+    if (fp != stdin)
+    {
+        fclose(fp);
+    }
+
+    /* cpuid_table_regs() binary searches */
+    qsort(table->leaves, table->count, sizeof(table->leaves[0]), compare_cpuid_leaf);
+    return 0;
+}
+
+/*
+ * Parse the first CPU of a "cpuid -r" dump held in memory. The buffer is
+ * modified in place; no allocation happens per record.
+ */
+static void parse_cpu_dump_text(char *text, size_t len, cpuid_table *table)
+{
+    int cpu_blocks = 0;
+    char *line = text, *end = text + len, *next = NULL;
+
+    for (; line < end; line = next)
+    {
+        next = memchr(line, '\n', end - line);
+        if (!next)
+        {
+            /* a truncated last line is not worth parsing */
+            break;
+        }
+        *next++ = '\0';
+
+        if (!strncmp(line, "CPU", 3) && cpu_blocks++)
+        {
+            break;
+        }
+        parse_cpuid_line(line, table);
+    }
+
+    qsort(table->leaves, table->count, sizeof(table->leaves[0]), compare_cpuid_leaf);
+    return;
+}
+
+static void decode_x86_brand_string(const cpuid_table *table, char *brand, size_t len)
+{
+    int i = 0;
+    char raw[49];
+    const uint32_t *regs = NULL;
+
+    brand[0] = '\0';
+    for (i = 0; i < 3; i++)
+    {
+        regs = cpuid_table_regs(table, 0x80000002 + i, 0);
+        if (!regs)
+        {
+            return;
+        }
+        memcpy(&raw[i * 16], regs, 16);
+    }
+    raw[48] = '\0';
+
+    /* Intel right-justifies the brand string */
+    for (i = 0; raw[i] == ' '; i++)
+        ;
+    snprintf(brand, len, "%s", &raw[i]);
+    return;
+}
+
+static uint32_t batch_hash(uint32_t value)
+{
+    int i = 0;
+    uint32_t hash = 2166136261u;
+
+    /* FNV-1a */
+    for (i = 0; i < 4; i++, value >>= 8)
+    {
+        hash = (hash ^ (value & 0xFF)) * 16777619u;
+    }
+    return hash;
+}
+
+static void batch_count_model(batch_stats *stats, uint32_t key, unsigned long count)
+{
+    uint32_t i = 0, slot = batch_hash(key) & (BATCH_HASH_SIZE - 1);
+
+    for (i = 0; i < BATCH_HASH_SIZE; i++, slot = (slot + 1) & (BATCH_HASH_SIZE - 1))
+    {
+        batch_count *entry = &stats->models[slot];
+
+        if (!entry->count || (entry->key == key))
+        {
+            entry->key = key;
+            entry->count += count;
+            return;
+        }
+    }
+    stats->overflow += count;
+    return;
+}
+
+static void batch_put_slot(batch_pool *pool, batch_slot *slot)
+{
+    pthread_mutex_lock(&pool->lock);
+    slot->next = pool->free_list;
+    pool->free_list = slot;
+    pthread_cond_signal(&pool->slot_cond);
+    pthread_mutex_unlock(&pool->lock);
+    return;
+}
+
+/* Blocks until a worker releases a slot, which bounds memory use */
+static batch_slot *batch_get_slot(batch_pool *pool)
+{
+    batch_slot *slot = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->free_list)
+    {
+        pthread_cond_wait(&pool->slot_cond, &pool->lock);
+    }
+    slot = pool->free_list;
+    pool->free_list = slot->next;
+    pthread_mutex_unlock(&pool->lock);
+
+    slot->len = 0;
+    slot->is_file = 0;
+    return slot;
+}
+
+static void batch_submit(batch_pool *pool, batch_slot *slot)
+{
+    batch_worker *worker = &pool->workers[pool->next_worker];
+
+    pool->next_worker = (pool->next_worker + 1) % pool->worker_num;
+
+    pthread_mutex_lock(&worker->lock);
+    worker->queue[(worker->head + worker->count) % pool->slot_num] = slot;
+    worker->count++;
+    pthread_mutex_unlock(&worker->lock);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->queued++;
+    pthread_cond_signal(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+    return;
+}
+
+/*
+ * Pop from the front of our own deque, or steal from the back of
+ * another worker's when ours is empty.
+ */
+static batch_slot *batch_take(batch_pool *pool, batch_worker *self)
+{
+    int i = 0;
+    batch_slot *slot = NULL;
+
+    pthread_mutex_lock(&self->lock);
+    if (self->count)
+    {
+        slot = self->queue[self->head];
+        self->head = (self->head + 1) % pool->slot_num;
+        self->count--;
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    for (i = 1; !slot && (i < pool->worker_num); i++)
+    {
+        batch_worker *victim = &pool->workers[(self->id + i) % pool->worker_num];
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->count)
+        {
+            victim->count--;
+            slot = victim->queue[(victim->head + victim->count) % pool->slot_num];
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+
+    if (slot)
+    {
+        pthread_mutex_lock(&pool->lock);
+        pool->queued--;
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return slot;
+}
+
+static int batch_read_file(batch_slot *slot)
+{
+    int fd = -1;
+    ssize_t n = 0;
+
+    fd = open(slot->name, O_RDONLY);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    /* the first CPU of a dump is always near the start of the file */
+    while ((slot->len < sizeof(slot->text)) &&
+           ((n = read(fd, slot->text + slot->len, sizeof(slot->text) - slot->len)) > 0))
+    {
+        slot->len += n;
+    }
+    close(fd);
+    return (n == -1) ? -1 : 0;
+}
+
+static void batch_process(batch_slot *slot, batch_stats *stats)
+{
+    int i = 0, len = 0;
+    char brand[64];
+    const char *name = NULL;
+    x86_cpu_info *info = &slot->info;
+
+    if (slot->is_file && (batch_read_file(slot) == -1))
+    {
+        warn("%s", slot->name);
+        stats->failed++;
+        return;
+    }
+
+    slot->table.count = 0;
+    slot->table.xcr0_valid = 0;
+    parse_cpu_dump_text(slot->text, slot->len, &slot->table);
+    if (!cpuid_table_regs(&slot->table, CPUID_STANDARD_0_MASK, 0))
+    {
+        warnx("%s: no CPUID leaves", slot->name);
+        stats->failed++;
+        return;
+    }
+
+    memset(info, 0, sizeof(*info));
+    decode_x86_cpu_info(&slot->table, info);
+    decode_x86_brand_string(&slot->table, brand, sizeof(brand));
+
+    name = strrchr(slot->name, '/');
+    name = name ? name + 1 : slot->name;
+    len = snprintf(slot->line, sizeof(slot->line), "%s\t%s\t%u\t%u\t%u\t%d\t%d\t%s\t%s\t%s\t%s\t%s\t",
+            name, info->vendor, info->family, info->model, info->stepping,
+            info->threads_per_core, info->cores_per_socket,
+            info->l1d_cache[0] ? info->l1d_cache : "-", info->l1i_cache[0] ? info->l1i_cache : "-",
+            info->l2_cache[0] ? info->l2_cache : "-", info->l3_cache[0] ? info->l3_cache : "-",
+            brand[0] ? brand : "-");
+    len = MIN(len, sizeof(slot->line) - 1);
+    len += format_x86_flags(info->features, slot->line + len, sizeof(slot->line) - len);
+    len = MIN(len, sizeof(slot->line) - 2);
+    slot->line[len++] = '\n';
+    /* one stdio call per record, so lines from different workers don't interleave */
+    fwrite(slot->line, 1, len, stdout);
+
+    stats->records++;
+    stats->families[MIN(info->family, BATCH_MAX_FAMILY - 1)]++;
+    batch_count_model(stats, ((uint32_t)info->vendor_id << 24) | ((uint32_t)info->family << 8) | info->model, 1);
+    for (i = 0; i < X86_FEATURE_NUM; i++)
+    {
+        stats->features[i] += X86_HAS_FEATURE(info, i);
+    }
+    return;
+}
+
+static void *batch_worker_main(void *arg)
+{
+    batch_worker *self = arg;
+    batch_pool *pool = self->pool;
+    batch_slot *slot = NULL;
+
+    for (;;)
+    {
+        slot = batch_take(pool, self);
+        if (!slot)
+        {
+            pthread_mutex_lock(&pool->lock);
+            while (!pool->queued && !pool->done)
+            {
+                pthread_cond_wait(&pool->work_cond, &pool->lock);
+            }
+            if (!pool->queued && pool->done)
+            {
+                pthread_mutex_unlock(&pool->lock);
+                break;
+            }
+            pthread_mutex_unlock(&pool->lock);
+            continue;
+        }
+
+        batch_process(slot, &self->stats);
+        batch_put_slot(pool, slot);
+    }
+    return NULL;
+}
+
+static void batch_read_dir(batch_pool *pool, const char *path)
+{
+    DIR *dir = NULL;
+    struct dirent *entry = NULL;
+    batch_slot *slot = NULL;
+
+    dir = opendir(path);
+    if (!dir)
+    {
+        err(1, "%s", path);
+    }
+
+    /* workers read the files themselves, we only hand out names */
+    while ((entry = readdir(dir)))
+    {
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+        slot = batch_get_slot(pool);
+        if (snprintf(slot->name, sizeof(slot->name), "%s/%s", path, entry->d_name) >= (int)sizeof(slot->name))
+        {
+            warnx("%s/%s: path too long", path, entry->d_name);
+            batch_put_slot(pool, slot);
+            continue;
+        }
+        slot->is_file = 1;
+        batch_submit(pool, slot);
+    }
+    closedir(dir);
+    return;
+}
+
+/* Queue the record being collected, if it has any leaves */
+static void batch_end_record(batch_pool *pool, batch_slot **slot)
+{
+    if (*slot && (*slot)->len)
+    {
+        batch_submit(pool, *slot);
+        *slot = NULL;
+    }
+    return;
+}
+
+/*
+ * Split a stream of concatenated dumps into records. A record starts at
+ * a "# host NAME" line, at a "# lscpu dump" header, or at a CPU 0 header
+ * following another CPU 0 block; the leaves of other CPUs are skipped.
+ */
+static void batch_read_stream(batch_pool *pool, FILE *fp)
+{
+    int seen_cpu = 0, skip = 0;
+    size_t len = 0;
+    unsigned long ordinal = 0;
+    char line[512];
+    batch_slot *slot = NULL;
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (!strncmp(line, "# host ", 7) || !strncmp(line, "# lscpu dump", 12))
+        {
+            batch_end_record(pool, &slot);
+            if (line[2] == 'h')
+            {
+                if (!slot)
+                {
+                    slot = batch_get_slot(pool);
+                }
+                line[strcspn(line, "\n")] = '\0';
+                snprintf(slot->name, sizeof(slot->name), "%.*s", (int)sizeof(slot->name) - 1, line + 7);
+            }
+            seen_cpu = 0;
+            skip = 0;
+            continue;
+        }
+
+        if (!strncmp(line, "CPU", 3))
+        {
+            /* "cpuid -r -1" prints "CPU:", a full dump "CPU 0:", "CPU 1:"... */
+            if ((line[3] != ':') && strncmp(line, "CPU 0:", 6))
+            {
+                skip = 1;
+                continue;
+            }
+            if (seen_cpu)
+            {
+                batch_end_record(pool, &slot);
+            }
+            seen_cpu = 1;
+            skip = 0;
+            continue;
+        }
+
+        if (skip || ((line[strspn(line, " \t")] != '0') && strncmp(line, "xcr0 ", 5)))
+        {
+            continue;
+        }
+
+        if (!slot)
+        {
+            slot = batch_get_slot(pool);
+            snprintf(slot->name, sizeof(slot->name), "record-%lu", ordinal++);
+        }
+
+        len = strlen(line);
+        if (slot->len + len <= sizeof(slot->text))
+        {
+            memcpy(slot->text + slot->len, line, len);
+            slot->len += len;
+        }
+    }
+
+    batch_end_record(pool, &slot);
+    if (slot)
+    {
+        batch_put_slot(pool, slot);
+    }
+    return;
+}
+
+static int compare_batch_count(const void *a, const void *b)
+{
+    const batch_count *x = a, *y = b;
+
+    return (x->count < y->count) - (x->count > y->count);
+}
+
+static void print_batch_stats(batch_stats *total)
+{
+    int i = 0, n = 0;
+    char label[64];
+    batch_count features[X86_FEATURE_NUM];
+
+    printf("# %-22s %lu\n", "records:", total->records);
+    printf("# %-22s %lu\n", "failed:", total->failed);
+    for (i = 0; i < BATCH_MAX_FAMILY; i++)
+    {
+        if (total->families[i])
+        {
+            snprintf(label, sizeof(label), "family %d:", i);
+            printf("# %-22s %lu\n", label, total->families[i]);
+        }
+    }
+
+    /* compact the hash tables in place, then sort by prevalence */
+    for (i = 0, n = 0; i < BATCH_HASH_SIZE; i++)
+    {
+        if (total->models[i].count)
+        {
+            total->models[n++] = total->models[i];
+        }
+    }
+    qsort(total->models, n, sizeof(total->models[0]), compare_batch_count);
+    for (i = 0; i < n; i++)
+    {
+        uint32_t key = total->models[i].key;
+        int vendor_id = key >> 24;
+
+        snprintf(label, sizeof(label), "model %s %u/%u:",
+                vendor_id == X86_VENDOR_INTEL ? "Intel" : (vendor_id == X86_VENDOR_AMD ? "AMD" : "other"),
+                (key >> 8) & 0xFFFF, key & 0xFF);
+        printf("# %-22s %lu\n", label, total->models[i].count);
+    }
+    if (total->overflow)
+    {
+        /* the model table was full, so these hosts are in no model line */
+        printf("# %-22s %lu\n", "models not counted:", total->overflow);
+    }
+
+    for (i = 0, n = 0; i < X86_FEATURE_NUM; i++)
+    {
+        if (total->features[i])
+        {
+            features[n].key = i;
+            features[n++].count = total->features[i];
+        }
+    }
+    qsort(features, n, sizeof(features[0]), compare_batch_count);
+    for (i = 0; i < n; i++)
+    {
+        snprintf(label, sizeof(label), "flag %s:", x86_features[features[i].key].name);
+        printf("# %-22s %lu (%.1f%%)\n", label, features[i].count,
+                total->records ? 100.0 * features[i].count / total->records : 0.0);
+    }
+    return;
+}
+
+/*
+ * Decode a directory of dumps, or a stream of concatenated dumps, on a
+ * pool of work-stealing threads. All record buffers are allocated up
+ * front, so memory stays bounded however large the corpus is.
+ */
+static void run_batch(const char *path, int worker_num)
+{
+    int i = 0, j = 0;
+    struct stat st;
+    batch_pool pool;
+    batch_stats *total = NULL;
+    FILE *fp = stdin;
+
+    memset(&pool, 0, sizeof(pool));
+    pool.worker_num = worker_num;
+    pool.slot_num = worker_num * BATCH_SLOTS_PER_WORKER;
+    pool.slots = calloc(pool.slot_num, sizeof(*pool.slots));
+    pool.workers = calloc(worker_num, sizeof(*pool.workers));
+    total = calloc(1, sizeof(*total));
+    if (!pool.slots || !pool.workers || !total)
+    {
+        err(1, "calloc");
+    }
+
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.slot_cond, NULL);
+    pthread_cond_init(&pool.work_cond, NULL);
+    for (i = 0; i < pool.slot_num; i++)
+    {
+        pool.slots[i].next = pool.free_list;
+        pool.free_list = &pool.slots[i];
+    }
+
+    printf("# host\tvendor\tfamily\tmodel\tstepping\tthreads/core\tcores/socket\tL1d\tL1i\tL2\tL3\tmodel name\tflags\n");
+    for (i = 0; i < worker_num; i++)
+    {
+        batch_worker *worker = &pool.workers[i];
+
+        worker->id = i;
+        worker->pool = &pool;
+        worker->queue = calloc(pool.slot_num, sizeof(*worker->queue));
+        if (!worker->queue)
+        {
+            err(1, "calloc");
+        }
+        pthread_mutex_init(&worker->lock, NULL);
+        if ((errno = pthread_create(&worker->thread, NULL, batch_worker_main, worker)))
+        {
+            err(1, "pthread_create");
+        }
+    }
+
+    if (strcmp(path, "-") && (stat(path, &st) == 0) && S_ISDIR(st.st_mode))
+    {
+        batch_read_dir(&pool, path);
+    }
+    else
+    {
+        if (strcmp(path, "-") && !(fp = fopen(path, "r")))
+        {
+            err(1, "%s", path);
+        }
+        batch_read_stream(&pool, fp);
+        if (fp != stdin)
+        {
+            fclose(fp);
+        }
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.done = 1;
+    pthread_cond_broadcast(&pool.work_cond);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (i = 0; i < worker_num; i++)
+    {
+        batch_stats *stats = &pool.workers[i].stats;
+
+        pthread_join(pool.workers[i].thread, NULL);
+        total->records += stats->records;
+        total->failed += stats->failed;
+        total->overflow += stats->overflow;
+        for (j = 0; j < BATCH_MAX_FAMILY; j++)
+        {
+            total->families[j] += stats->families[j];
+        }
+        for (j = 0; j < X86_FEATURE_NUM; j++)
+        {
+            total->features[j] += stats->features[j];
+        }
+        for (j = 0; j < BATCH_HASH_SIZE; j++)
+        {
+            if (stats->models[j].count)
+            {
+                batch_count_model(total, stats->models[j].key, stats->models[j].count);
+            }
+        }
+        pthread_mutex_destroy(&pool.workers[i].lock);
+        free(pool.workers[i].queue);
+    }
+
+    print_batch_stats(total);
+
+    pthread_cond_destroy(&pool.work_cond);
+    pthread_cond_destroy(&pool.slot_cond);
+    pthread_mutex_destroy(&pool.lock);
+    free(total);
+    free(pool.workers);
+    free(pool.slots);
+    return;
+}
+
+/*
+ * Nothing in the snapshot changes until the next boot or kernel update,
+ * so key it on both.
+ */
+static int get_snapshot_key(char *boot_id, size_t boot_id_len, char *kernel, size_t kernel_len)
+{
+    struct utsname name;
+#ifdef __linux__
+    FILE *fp = NULL;
+
+    fp = fopen("/proc/sys/kernel/random/boot_id", "r");
+    if (!fp)
+    {
+        return -1;
+    }
+    if (!fgets(boot_id, boot_id_len, fp))
+    {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    boot_id[strcspn(boot_id, "\n")] = '\0';
+#else /* BSDs */
+    int mib[2] = {CTL_KERN, KERN_BOOTTIME};
+    struct timeval boottime;
+    size_t len = sizeof(boottime);
+
+    if (sysctl(mib, ARRAY_LEN(mib), &boottime, &len, NULL, 0) == -1)
+    {
+        return -1;
+    }
+    snprintf(boot_id, boot_id_len, "%lld.%06ld", (long long)boottime.tv_sec, (long)boottime.tv_usec);
+#endif
+
+    if (uname(&name) == -1)
+    {
+        return -1;
+    }
+    snprintf(kernel, kernel_len, "%s %s", name.release, name.version);
+    return 0;
+}
+
+static const char *get_snapshot_path(void)
+{
+    static char path[PATH_MAX];
+    const char *env = getenv("LSCPU_SNAPSHOT");
+
+    if (env && *env)
+    {
+        return env;
+    }
+    snprintf(path, sizeof(path), "/tmp/lscpu-%u.snapshot", (unsigned int)geteuid());
+    return path;
+}
+
+/*
+ * Identify the feature table the snapshot's bitsets are indexed by, so a
+ * rebuild that reorders X86_FEATURE_LIST or changes an entry invalidates
+ * old snapshots even when nobody bumped SNAPSHOT_VERSION.
+ */
+static uint32_t snapshot_build_id(void)
+{
+    int i = 0;
+    uint32_t hash = X86_FEATURE_NUM;
+
+    for (i = 0; i < X86_FEATURE_NUM; i++)
+    {
+        const x86_feature *feature = &x86_features[i];
+        uint32_t fields[6] = {feature->leaf, feature->subleaf, feature->reg,
+                              feature->bit, feature->vendors, feature->xstate};
+
+        hash = (hash ^ hash_feature_name(feature->name, strlen(feature->name))) * 16777619u;
+        hash = (hash ^ hash_feature_name((const char *)fields, sizeof(fields))) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Map a snapshot written by an earlier run. Returns NULL if there is none,
+ * or if it was written with another struct layout or feature table, or on
+ * another boot or kernel.
+ */
+static const cpu_snapshot *load_snapshot(void)
+{
+    int fd = -1;
+    struct stat st;
+    const cpu_snapshot *snapshot = NULL;
+    char boot_id[SNAPSHOT_KEY_LEN], kernel[SNAPSHOT_KERNEL_LEN];
+
+    fd = open(get_snapshot_path(), O_RDONLY | O_NOFOLLOW);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    /* only trust a regular file of the right size that we wrote ourselves */
+    if ((fstat(fd, &st) == -1) || !S_ISREG(st.st_mode) || (st.st_uid != geteuid()) ||
+        (st.st_size != sizeof(cpu_snapshot)))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    snapshot = mmap(NULL, sizeof(cpu_snapshot), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (snapshot == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    if ((snapshot->magic != SNAPSHOT_MAGIC) || (snapshot->version != SNAPSHOT_VERSION) ||
+        (snapshot->size != sizeof(cpu_snapshot)) || (snapshot->build_id != snapshot_build_id()) ||
+        (get_snapshot_key(boot_id, sizeof(boot_id), kernel, sizeof(kernel)) == -1) ||
+        strncmp(snapshot->boot_id, boot_id, sizeof(boot_id)) ||
+        strncmp(snapshot->kernel, kernel, sizeof(kernel)))
+    {
+        munmap((void *)snapshot, sizeof(cpu_snapshot));
+        return NULL;
+    }
+    return snapshot;
+}
+
+/* Failing to save is not an error, the next run just probes again */
+static void save_snapshot(gen_cpu_info *gen_info, x86_cpu_info *x86_info, cpuid_table *table)
+{
+    int fd = -1;
+    char tmp_path[PATH_MAX];
+    const char *path = get_snapshot_path();
+    cpu_snapshot *snapshot = NULL;
+
+    snapshot = calloc(1, sizeof(*snapshot));
+    if (!snapshot)
+    {
+        return;
+    }
+
+    snapshot->magic = SNAPSHOT_MAGIC;
+    snapshot->version = SNAPSHOT_VERSION;
+    snapshot->size = sizeof(cpu_snapshot);
+    snapshot->build_id = snapshot_build_id();
+    if (get_snapshot_key(snapshot->boot_id, sizeof(snapshot->boot_id), snapshot->kernel, sizeof(snapshot->kernel)) == -1)
+    {
+        free(snapshot);
+        return;
+    }
+    memcpy(&snapshot->gen_info, gen_info, sizeof(*gen_info));
+    memcpy(&snapshot->x86_info, x86_info, sizeof(*x86_info));
+    memcpy(&snapshot->cpuid_raw, table, sizeof(*table));
+
+    /* write a private temporary file and rename it so readers never see a partial snapshot */
+    snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+    fd = mkstemp(tmp_path);
+    if (fd == -1)
+    {
+        free(snapshot);
+        return;
+    }
+
+    if ((write(fd, snapshot, sizeof(*snapshot)) != sizeof(*snapshot)) || (rename(tmp_path, path) == -1))
+    {
+        unlink(tmp_path);
+    }
+    close(fd);
+    free(snapshot);
+    return;
+}
+
+static int bind_to_cpu(int cpu)
+{
+#if defined(__linux__) || defined(__DragonFly__)
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set);
+#elif defined(__FreeBSD__)
+    cpuset_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return cpuset_setaffinity(CPU_LEVEL_WHICH, CPU_WHICH_TID, -1, sizeof(set), &set);
+#elif defined(__NetBSD__)
+    int ret = 0;
+    cpuset_t *set = cpuset_create();
+
+    if (!set)
+    {
+        return -1;
+    }
+    cpuset_set(cpu, set);
+    ret = pthread_setaffinity_np(pthread_self(), cpuset_size(set), set);
+    cpuset_destroy(set);
+    if (ret)
+    {
+        errno = ret;
+        return -1;
+    }
+    return 0;
+#else /* macOS and OpenBSD can't pin threads */
+    (void)cpu;
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
+
+/* The CPUs this process may run on, in ascending order */
+static int get_affinity_cpus(int *cpus, int max)
+{
+    int i = 0, n = 0;
+#if defined(__linux__) || defined(__DragonFly__)
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == -1)
+    {
+        return -1;
+    }
+    for (i = 0; (i < CPU_SETSIZE) && (n < max); i++)
+    {
+        if (CPU_ISSET(i, &set))
+        {
+            cpus[n++] = i;
+        }
+    }
+#elif defined(__FreeBSD__)
+    cpuset_t set;
+
+    CPU_ZERO(&set);
+    if (cpuset_getaffinity(CPU_LEVEL_WHICH, CPU_WHICH_PID, -1, sizeof(set), &set) == -1)
+    {
+        return -1;
+    }
+    for (i = 0; (i < CPU_SETSIZE) && (n < max); i++)
+    {
+        if (CPU_ISSET(i, &set))
+        {
+            cpus[n++] = i;
+        }
+    }
+#elif defined(__NetBSD__)
+    int ret = 0;
+    cpuset_t *set = cpuset_create();
+
+    if (!set)
+    {
+        return -1;
+    }
+    if ((ret = pthread_getaffinity_np(pthread_self(), cpuset_size(set), set)))
+    {
+        cpuset_destroy(set);
+        errno = ret;
+        return -1;
+    }
+    /* an empty set means no affinity was ever set */
+    for (i = 0; (cpuset_isset(i, set) >= 0) && (n < max); i++)
+    {
+        if (cpuset_isset(i, set) > 0)
+        {
+            cpus[n++] = i;
+        }
+    }
+    cpuset_destroy(set);
+    if (!n)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+#else
+    (void)i;
+    (void)cpus;
+    (void)max;
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+    return n;
+}
+
+/*
+ * The CPUs per-CPU work runs on: the affinity mask, else the online list.
+ * Either may be sparse, so CPU IDs are never assumed to be 0 to n - 1
+ * unless the platform can't name them.
+ */
+static int get_cpu_ids(int *cpus, int max, int cpu_num)
+{
+    int i = 0, n = 0;
+#ifdef __linux__
+    unsigned char online[AFFINITY_MAX_CPUS];
+#endif
+
+    if ((n = get_affinity_cpus(cpus, max)) > 0)
+    {
+        return n;
+    }
+#ifdef __linux__
+    max = MIN(max, AFFINITY_MAX_CPUS);
+    if (read_cpu_set("/sys/devices/system/cpu/online", NULL, online, max) == 0)
+    {
+        for (i = 0, n = 0; i < max; i++)
+        {
+            if (online[i])
+            {
+                cpus[n++] = i;
+            }
+        }
+        if (n)
+        {
+            return n;
+        }
+    }
+#endif
+    for (i = 0; (i < MAX(cpu_num, 1)) && (i < max); i++)
+    {
+        cpus[i] = i;
+    }
+    return i;
+}
+
+static void *percpu_worker(void *arg)
+{
+    percpu_info *info = arg;
+
+    if (bind_to_cpu(info->cpu) == -1)
+    {
+        /* offline or not in our cpuset, leave it marked invalid */
+        return NULL;
+    }
+
+#if defined(__amd64__) || defined(__i386__)
+    get_x86_percpu_info(info);
+    info->valid = 1;
+#endif
+    return NULL;
+}
+
+/*
+ * Spawn one pinned worker per logical CPU so every CPU runs its own
+ * collection concurrently; a single migrating thread would pay a full
+ * migration per CPU and scale linearly with the CPU count.
+ */
+static int sweep_cpus(percpu_info *table, const int *cpus, int cpu_num)
+{
+    int i = 0, ret = 0, started = 0;
+    pthread_t *threads = NULL;
+    pthread_attr_t attr;
+
+    threads = calloc(cpu_num, sizeof(*threads));
+    if (!threads)
+    {
+        return -1;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, PERCPU_STACK_SIZE);
+    for (i = 0; i < cpu_num; i++)
+    {
+        table[i].cpu = cpus[i];
+        ret = pthread_create(&threads[i], &attr, percpu_worker, &table[i]);
+        if (ret)
+        {
+            break;
+        }
+        started++;
+    }
+    pthread_attr_destroy(&attr);
+
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    if (ret)
+    {
+        errno = ret;
+        return -1;
+    }
+    return 0;
+}
+
+static uint32_t topology_field(uint32_t apic_id, int low, int high)
+{
+    return (high > low) ? (apic_id >> low) & ((1U << (high - low)) - 1) : 0;
+}
+
+/* AMD's extended APIC ID in leaf 0x8000001E is 32 bits like the x2APIC one */
+static uint32_t percpu_apic_id(const percpu_info *info, const x86_cpu_info *x86_info)
+{
+    if ((x86_info->vendor_id == X86_VENDOR_AMD) && X86_HAS_FEATURE(x86_info, X86_FEATURE_TOPOEXT))
+    {
+        return info->amd_topology[CPUID_EAX];
+    }
+    return info->x2apic_id;
+}
+
+/* Split every CPU's APIC ID into its package, die, module, core and SMT IDs */
+static void decode_percpu_topology(percpu_info *table, int cpu_num, const x86_cpu_info *x86_info)
+{
+    int i = 0;
+    const x86_topology *topology = &x86_info->topology;
+    int amd = (x86_info->vendor_id == X86_VENDOR_AMD) && X86_HAS_FEATURE(x86_info, X86_FEATURE_TOPOEXT);
+
+    for (i = 0; i < cpu_num; i++)
+    {
+        percpu_info *info = &table[i];
+        uint32_t apic_id = percpu_apic_id(info, x86_info);
+
+        if (!info->valid)
+        {
+            continue;
+        }
+        if (amd)
+        {
+            /* the node ID of leaf 0x8000001E */
+            info->die = (info->amd_topology[CPUID_ECX] & 0xFF) % (((info->amd_topology[CPUID_ECX] >> 8) & 0x7) + 1);
+        }
+        else
+        {
+            info->die = topology_field(apic_id, topology->module_shift, topology->die_shift);
+        }
+        info->smt = topology_field(apic_id, 0, topology->smt_shift);
+        info->core = topology_field(apic_id, topology->smt_shift, topology->core_shift);
+        info->module = topology_field(apic_id, topology->core_shift, topology->module_shift);
+        info->package = (topology->package_shift < 32) ? apic_id >> topology->package_shift : 0;
+    }
+    return;
+}
+
+static int compare_uint64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * Count the packages and physical cores the CPUs really sit on, which
+ * division can't get right on partially disabled or hybrid parts.
+ */
+static void count_topology(percpu_info *table, int cpu_num, x86_cpu_info *x86_info)
+{
+    int i = 0, n = 0, sockets = 0, cores = 0;
+    uint64_t *keys = NULL;
+
+    if ((cpu_num <= 0) || !(keys = calloc(2 * (size_t)cpu_num, sizeof(*keys))))
+    {
+        return;
+    }
+    for (i = 0; i < cpu_num; i++)
+    {
+        if (table[i].valid)
+        {
+            keys[n] = table[i].package;
+            keys[cpu_num + n] = ((uint64_t)table[i].package << 40) | ((uint64_t)table[i].die << 32) |
+                                ((uint64_t)table[i].module << 16) | table[i].core;
+            n++;
+        }
+    }
+    qsort(keys, n, sizeof(*keys), compare_uint64);
+    qsort(keys + cpu_num, n, sizeof(*keys), compare_uint64);
+    for (i = 0; i < n; i++)
+    {
+        sockets += !i || (keys[i] != keys[i - 1]);
+        cores += !i || (keys[cpu_num + i] != keys[cpu_num + i - 1]);
+    }
+    free(keys);
+
+    if (sockets)
+    {
+        x86_info->sockets = sockets;
+        x86_info->cores_per_socket = cores / sockets;
+    }
+    return;
+}
+
+/* Sweep the given CPUs, row i is cpus[i]; returns NULL if none of them could be run on */
+static percpu_info *collect_percpu_info(const int *cpus, int cpu_num, x86_cpu_info *x86_info)
+{
+    int i = 0;
+    percpu_info *table = calloc(cpu_num, sizeof(*table));
+
+    if (!table)
+    {
+        err(1, "calloc");
+    }
+    if (sweep_cpus(table, cpus, cpu_num) == -1)
+    {
+        err(1, "sweep_cpus");
+    }
+    for (i = 0; (i < cpu_num) && !table[i].valid; i++)
+        ;
+    if (i == cpu_num)
+    {
+        free(table);
+        return NULL;
+    }
+    decode_percpu_topology(table, cpu_num, x86_info);
+    return table;
+}
+
+static uint64_t now_nsec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Map a benchmark buffer, backed by huge pages where the system has them
+ * so TLB misses don't blur the cache knees. *huge says whether it worked.
+ */
+static void *bench_alloc(size_t size, int *huge)
+{
+    void *buf = MAP_FAILED;
+
+    *huge = 0;
+#if defined(__linux__) && defined(MAP_HUGETLB)
+    size = (size + BENCH_HUGE_PAGE - 1) & ~(size_t)(BENCH_HUGE_PAGE - 1);
+    buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    *huge = (buf != MAP_FAILED);
+#elif defined(__FreeBSD__) && defined(MAP_ALIGNED_SUPER)
+    /* superpages are promoted transparently once aligned and fully touched */
+    buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON | MAP_ALIGNED_SUPER, -1, 0);
+    *huge = (buf != MAP_FAILED);
+#endif
+    if (buf == MAP_FAILED)
+    {
+        buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (buf == MAP_FAILED)
+        {
+            return NULL;
+        }
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        /* transparent huge pages */
+        *huge = (madvise(buf, size, MADV_HUGEPAGE) == 0) ? 2 : 0;
+#endif
+    }
+    memset(buf, 0, size);
+    return buf;
+}
+
+static void bench_free(void *buf, size_t size)
+{
+#if defined(__linux__) && defined(MAP_HUGETLB)
+    size = (size + BENCH_HUGE_PAGE - 1) & ~(size_t)(BENCH_HUGE_PAGE - 1);
+#endif
+    munmap(buf, size);
+    return;
+}
+
+static uint64_t bench_random(uint64_t *state)
+{
+    /* xorshift64 */
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/*
+ * Link every line of the first size bytes into one random cycle (Sattolo)
+ * and return the best average load-to-use latency of a few runs, in
+ * nanoseconds, so a preempted run doesn't fake a knee.
+ */
+static double chase_latency(void *buf, size_t size, size_t line)
+{
+    size_t i = 0, j = 0, lines = size / line;
+    uint64_t state = 0x9E3779B97F4A7C15ULL, start = 0, nsec = 0, best = 0;
+    size_t *order = malloc(lines * sizeof(*order));
+    void **p = NULL;
+    long loads = 0;
+    int run = 0;
+
+    if (!order)
+    {
+        err(1, "malloc");
+    }
+    for (i = 0; i < lines; i++)
+    {
+        order[i] = i;
+    }
+    for (i = lines - 1; i > 0; i--)
+    {
+        size_t tmp = 0;
+
+        j = bench_random(&state) % i;
+        tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    for (i = 0; i < lines; i++)
+    {
+        *(void **)((char *)buf + order[i] * line) = (char *)buf + order[(i + 1) % lines] * line;
+    }
+    free(order);
+
+    /* one lap to warm up, then time a fixed number of dependent loads */
+    p = buf;
+    for (i = 0; i < lines; i++)
+    {
+        p = *p;
+    }
+    for (run = 0; run < BENCH_CHASE_RUNS; run++)
+    {
+        start = now_nsec();
+        for (loads = 0; loads < BENCH_CHASE_LOADS; loads += 8)
+        {
+            p = *p; p = *p; p = *p; p = *p;
+            p = *p; p = *p; p = *p; p = *p;
+        }
+        nsec = now_nsec() - start;
+        if (!best || (nsec < best))
+        {
+            best = nsec;
+        }
+    }
+    bench_sink = (uintptr_t)p;
+    return (double)best / BENCH_CHASE_LOADS;
+}
+
+static void cpu_barrier_init(cpu_barrier *barrier, int total)
+{
+    pthread_mutex_init(&barrier->lock, NULL);
+    pthread_cond_init(&barrier->cond, NULL);
+    barrier->total = total;
+    barrier->count = 0;
+    barrier->generation = 0;
+    return;
+}
+
+static void cpu_barrier_destroy(cpu_barrier *barrier)
+{
+    pthread_mutex_destroy(&barrier->lock);
+    pthread_cond_destroy(&barrier->cond);
+    return;
+}
+
+/* pthread_barrier_t is optional in POSIX and missing on macOS */
+static void cpu_barrier_wait(cpu_barrier *barrier)
+{
+    unsigned long generation = 0;
+
+    pthread_mutex_lock(&barrier->lock);
+    generation = barrier->generation;
+    if (++barrier->count == barrier->total)
+    {
+        barrier->count = 0;
+        barrier->generation++;
+        pthread_cond_broadcast(&barrier->cond);
+    }
+    else
+    {
+        while (generation == barrier->generation)
+        {
+            pthread_cond_wait(&barrier->cond, &barrier->lock);
+        }
+    }
+    pthread_mutex_unlock(&barrier->lock);
+    return;
+}
+
+static void *bandwidth_worker(void *arg)
+{
+    bandwidth_thread *self = arg;
+    size_t i = 0, words = self->size / sizeof(uint64_t);
+    uint64_t *buf = NULL, start = 0, sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+    int kernel = 0, rep = 0;
+
+    self->pinned = (bind_to_cpu(self->cpu) == 0);
+    /* allocate after pinning so first touch places it near this CPU */
+    buf = bench_alloc(self->size, &self->huge);
+    for (kernel = 0; kernel < BENCH_KERNELS; kernel++)
+    {
+        for (rep = 0; rep < BENCH_REPEATS; rep++)
+        {
+            cpu_barrier_wait(self->barrier);
+            start = now_nsec();
+            switch (buf ? kernel : -1)
+            {
+                case BENCH_READ:
+                {
+                    for (i = 0; i < words; i += 4)
+                    {
+                        sum0 += buf[i];
+                        sum1 += buf[i + 1];
+                        sum2 += buf[i + 2];
+                        sum3 += buf[i + 3];
+                    }
+                    break;
+                }
+                case BENCH_WRITE:
+                {
+                    for (i = 0; i < words; i++)
+                    {
+                        buf[i] = i;
+                    }
+                    break;
+                }
+                case BENCH_COPY:
+                {
+                    memcpy(buf + words / 2, buf, self->size / 2);
+                    break;
+                }
+                default:
+                {
+                    break;
+                }
+            }
+            self->nsec[kernel][rep] = now_nsec() - start;
+            cpu_barrier_wait(self->barrier);
+        }
+    }
+    self->sink = sum0 + sum1 + sum2 + sum3;
+    if (buf)
+    {
+        bench_free(buf, self->size);
+    }
+    return NULL;
+}
+
+/*
+ * Every thread streams its own buffer; a repetition lasts until the
+ * slowest thread is done, and the best repetition is reported.
+ */
+static void bench_bandwidth(const int *cpus, int cpu_num, int thread_num, size_t total)
+{
+    int i = 0, kernel = 0, rep = 0, pinned = 0, huge = 0;
+    static const char *names[BENCH_KERNELS] = {"Read:", "Write:", "Copy:"};
+    bandwidth_thread *threads = calloc(thread_num, sizeof(*threads));
+    cpu_barrier barrier;
+    pthread_attr_t attr;
+
+    if (!threads)
+    {
+        err(1, "calloc");
+    }
+    cpu_barrier_init(&barrier, thread_num);
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, PERCPU_STACK_SIZE);
+    for (i = 0; i < thread_num; i++)
+    {
+        /* more jobs than CPUs wrap around */
+        threads[i].cpu = cpus[i % cpu_num];
+        threads[i].size = MAX(total / thread_num, BENCH_HUGE_PAGE) & ~(size_t)63;
+        threads[i].barrier = &barrier;
+        if ((errno = pthread_create(&threads[i].thread, &attr, bandwidth_worker, &threads[i])))
+        {
+            err(1, "pthread_create");
+        }
+    }
+    pthread_attr_destroy(&attr);
+    for (i = 0; i < thread_num; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+        pinned += threads[i].pinned;
+        huge += (threads[i].huge != 0);
+    }
+    cpu_barrier_destroy(&barrier);
+
+    printf("%-24s %d (%d pinned, %d on huge pages), %zuM each\n", "Bandwidth threads:",
+            thread_num, pinned, huge, threads[0].size >> 20);
+    for (kernel = 0; kernel < BENCH_KERNELS; kernel++)
+    {
+        uint64_t best = 0;
+
+        for (rep = 0; rep < BENCH_REPEATS; rep++)
+        {
+            uint64_t slowest = 0;
+
+            for (i = 0; i < thread_num; i++)
+            {
+                slowest = MAX(slowest, threads[i].nsec[kernel][rep]);
+            }
+            if (!best || (slowest < best))
+            {
+                best = slowest;
+            }
+        }
+        /* a copy reads one half and writes the other */
+        printf("%-24s %.1f GB/s\n", names[kernel], best ? (double)threads[0].size * thread_num / best : 0.0);
+    }
+    free(threads);
+    return;
+}
+
+static void run_memory_bench(const int *cpus, int cpu_num, x86_cpu_info *x86_info, int thread_num)
+{
+    int i = 0, j = 0, huge = 0, size_num = 0, knee_num = 0, rising = 0;
+    size_t size = 0, line = 64, max_size = BENCH_MIN_SIZE, l3_size = 0;
+    size_t sizes[BENCH_MAX_SIZES], knees[X86_MAX_CACHES];
+    double latency[BENCH_MAX_SIZES];
+    char name[8], reported[CACHE_SIZE_LEN], measured[CACHE_SIZE_LEN];
+    void *buf = NULL;
+
+    for (i = 0; i < x86_info->cache_num; i++)
+    {
+        if (x86_info->caches[i].type != 2)
+        {
+            line = x86_info->caches[i].line_size;
+            max_size = MAX(max_size, 4 * x86_info->caches[i].size);
+            l3_size = MAX(l3_size, x86_info->caches[i].size);
+        }
+    }
+
+    /* pin the latency sweep so the caches it measures are one CPU's */
+    if (bind_to_cpu(cpus[0]) == 0)
+    {
+        printf("%-24s pinned to CPU %d\n", "Latency thread:", cpus[0]);
+    }
+    else
+    {
+        printf("%-24s %s\n", "Latency thread:", "not pinned");
+    }
+    if (!(buf = bench_alloc(max_size, &huge)))
+    {
+        err(1, "mmap");
+    }
+    printf("%-24s %s\n", "Huge pages:", (huge == 1) ? "yes" : ((huge == 2) ? "transparent" : "no"));
+
+    /* 4K up to four times the largest cache, in steps of 2 and 1.5 */
+    for (size = 4096; (size <= max_size) && (size_num < BENCH_MAX_SIZES - 1); size *= 2)
+    {
+        sizes[size_num] = size;
+        latency[size_num] = chase_latency(buf, size, line);
+        size_num++;
+        if (size * 3 / 2 <= max_size)
+        {
+            sizes[size_num] = size * 3 / 2;
+            latency[size_num] = chase_latency(buf, size * 3 / 2, line);
+            size_num++;
+        }
+    }
+    bench_free(buf, max_size);
+
+    /*
+     * A knee is the last size before the latency leaves its plateau; the
+     * climb to the next plateau often spans several sizes and is one knee.
+     */
+    printf("%-12s %s\n", "Size", "Latency");
+    for (i = 0; i < size_num; i++)
+    {
+        int knee = 0;
+
+        if ((i + 1 < size_num) && (latency[i + 1] > latency[i] * BENCH_KNEE_RATIO))
+        {
+            knee = !rising;
+            rising = 1;
+        }
+        else
+        {
+            rising = 0;
+        }
+
+        set_cache_size_bytes(measured, sizes[i], sizes[i] % (1024 * 1024) == 0);
+        printf("%-12s %.2f ns%s\n", measured, latency[i], knee ? "  <- knee" : "");
+        if (knee && (knee_num < X86_MAX_CACHES))
+        {
+            knees[knee_num++] = sizes[i];
+        }
+
+    }
+
+    /* pair the knees with the data caches, smallest first */
+    printf("%-6s %-10s %s\n", "Cache", "Reported", "Measured");
+    for (i = 0, j = 0; i < x86_info->cache_num; i++)
+    {
+        const x86_cache *cache = &x86_info->caches[i];
+
+        if (cache->type == 2)
+        {
+            continue;
+        }
+        set_cache_size_bytes(reported, cache->size, cache->size % (1024 * 1024) == 0);
+        if (j < knee_num)
+        {
+            set_cache_size_bytes(measured, knees[j], knees[j] % (1024 * 1024) == 0);
+        }
+        format_cache_name(cache, name, sizeof(name));
+        printf("%-6s %-10s %s\n", name, reported, (j < knee_num) ? measured : "-");
+        j++;
+    }
+
+    bench_bandwidth(cpus, cpu_num, thread_num, MAX(4 * l3_size, (size_t)BENCH_MIN_SIZE));
+    return;
+}
+
+/* Returns NULL where pages can't be bound to a node, the caller then relies on first touch */
+static void *numa_alloc(size_t size, int node)
+{
+#ifdef __linux__
+    unsigned long mask[(NUMA_MAX_NODES + 8 * sizeof(long) - 1) / (8 * sizeof(long))] = {0};
+    void *buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (buf == MAP_FAILED)
+    {
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(buf, size, MADV_HUGEPAGE);
+#endif
+    /* the kernel drops the last bit of maxnode, so pass one more */
+    mask[node / (8 * sizeof(long))] |= 1UL << (node % (8 * sizeof(long)));
+    if (syscall(SYS_mbind, buf, size, NUMA_MPOL_BIND, mask, NUMA_MAX_NODES + 1, 0) == -1)
+    {
+        munmap(buf, size);
+        return NULL;
+    }
+    memset(buf, 0, size);
+    return buf;
+#else
+    (void)size;
+    (void)node;
+    return NULL;
+#endif
+}
+
+/* Allocate from the given CPU, so first touch puts the pages on its node */
+static void *numa_touch_worker(void *arg)
+{
+    numa_thread *self = arg;
+    int huge = 0;
+
+    if ((self->pinned = (bind_to_cpu(self->cpu) == 0)))
+    {
+        self->buf = bench_alloc(self->size, &huge);
+    }
+    return NULL;
+}
+
+static void *numa_worker(void *arg)
+{
+    numa_thread *self = arg;
+    size_t i = 0, words = self->size / sizeof(uint64_t);
+    uint64_t *buf = self->buf, start = 0, nsec = 0, best = 0, sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+    int rep = 0;
+
+    self->pinned = (bind_to_cpu(self->cpu) == 0);
+    /* the latencies are idle ones: a chase keeps a single miss in flight */
+    cpu_barrier_wait(self->barrier);
+    self->latency = chase_latency(self->buf, self->size, self->line);
+    cpu_barrier_wait(self->barrier);
+    for (rep = 0; rep < BENCH_REPEATS; rep++)
+    {
+        start = now_nsec();
+        for (i = 0; i < words; i += 4)
+        {
+            sum0 += buf[i];
+            sum1 += buf[i + 1];
+            sum2 += buf[i + 2];
+            sum3 += buf[i + 3];
+        }
+        nsec = now_nsec() - start;
+        if (!best || (nsec < best))
+        {
+            best = nsec;
+        }
+    }
+    bench_sink = (uintptr_t)(sum0 + sum1 + sum2 + sum3);
+    self->bandwidth = best ? (double)self->size / best : 0;
+    return NULL;
+}
+
+/* Rows are CPU nodes and columns memory nodes, a negative value is printed as "-" */
+static void print_numa_matrix(const char *title, const numa_node *nodes, int node_num, const double *values)
+{
+    int i = 0, j = 0;
+
+    printf("\n%s\n%-5s", title, "Node");
+    for (j = 0; j < node_num; j++)
+    {
+        printf(" %-7d", nodes[j].id);
+    }
+    printf("\n");
+    for (i = 0; i < node_num; i++)
+    {
+        if (!nodes[i].cpu_num)
+        {
+            continue;
+        }
+        printf("%-5d", nodes[i].id);
+        for (j = 0; j < node_num; j++)
+        {
+            if (values[i * node_num + j] < 0)
+            {
+                printf(" %-7s", "-");
+            }
+            else
+            {
+                printf(" %-7.1f", values[i * node_num + j]);
+            }
+        }
+        printf("\n");
+    }
+    return;
+}
+
+/*
+ * Measure every (CPU node, memory node) pair with one thread pinned to the
+ * CPU node. In round r CPU node i reads memory node (i + r) mod n, so each
+ * round runs its pairs concurrently without two of them sharing a CPU node
+ * or a memory controller. n rounds cover all n * n pairs.
+ */
+static void run_numa_bench(x86_cpu_info *x86_info)
+{
+    int i = 0, j = 0, k = 0, n = 0, round = 0, pair_num = 0, bound = 0, touched = 0;
+    size_t size = 0, line = 64, l3_size = 0;
+    numa_node *nodes = calloc(NUMA_MAX_NODES, sizeof(*nodes));
+    numa_thread *threads = calloc(NUMA_MAX_NODES, sizeof(*threads));
+    int memory[NUMA_MAX_NODES];
+    double *latency = NULL, *bandwidth = NULL, *relative = NULL, *slit = NULL;
+    cpu_barrier barrier;
+    pthread_attr_t attr;
+
+    if (!nodes || !threads)
+    {
+        err(1, "calloc");
+    }
+    if ((n = get_numa_nodes(nodes, NUMA_MAX_NODES)) <= 0)
+    {
+        errx(1, "the NUMA benchmark needs NUMA node information");
+    }
+    if (!(latency = calloc(4 * n * n, sizeof(*latency))))
+    {
+        err(1, "calloc");
+    }
+    bandwidth = latency + n * n;
+    relative = bandwidth + n * n;
+    slit = relative + n * n;
+
+    /* the same sizing as --bench-memory: well past one CPU's caches */
+    for (i = 0; i < x86_info->cache_num; i++)
+    {
+        if (x86_info->caches[i].type != 2)
+        {
+            line = x86_info->caches[i].line_size;
+            l3_size = MAX(l3_size, x86_info->caches[i].size);
+        }
+    }
+    size = MAX(4 * l3_size, (size_t)BENCH_MIN_SIZE);
+    for (i = 0; i < n; i++)
+    {
+        /* every node holds one buffer per round, leave it half its free memory */
+        if (nodes[i].mem_free)
+        {
+            size = MIN(size, nodes[i].mem_free / 2);
+        }
+    }
+    size = MAX(size & ~(size_t)(BENCH_HUGE_PAGE - 1), (size_t)BENCH_HUGE_PAGE);
+
+    for (i = 0; i < n * n; i++)
+    {
+        latency[i] = bandwidth[i] = relative[i] = -1;
+        slit[i] = nodes[i / n].distance[i % n] ? nodes[i / n].distance[i % n] : -1;
+    }
+
+    for (round = 0; round < n; round++)
+    {
+        for (i = 0, k = 0; i < n; i++)
+        {
+            j = (i + round) % n;
+            if (!nodes[i].cpu_num || !nodes[j].mem_total)
+            {
+                continue;
+            }
+            memset(&threads[k], 0, sizeof(threads[k]));
+            for (threads[k].cpu = 0; !nodes[i].cpus[threads[k].cpu]; threads[k].cpu++)
+                ;
+            threads[k].size = size;
+            threads[k].line = line;
+            if ((threads[k].buf = numa_alloc(size, nodes[j].id)))
+            {
+                bound++;
+            }
+            else if (nodes[j].cpu_num)
+            {
+                numa_thread touch;
+
+                /* first touch from the memory node's own CPU, in a thread so ours stays unpinned */
+                memset(&touch, 0, sizeof(touch));
+                for (touch.cpu = 0; !nodes[j].cpus[touch.cpu]; touch.cpu++)
+                    ;
+                touch.size = size;
+                if (!(errno = pthread_create(&touch.thread, NULL, numa_touch_worker, &touch)))
+                {
+                    pthread_join(touch.thread, NULL);
+                    threads[k].buf = touch.buf;
+                    touched += (touch.buf != NULL);
+                }
+            }
+            if (!threads[k].buf)
+            {
+                continue;
+            }
+            memory[k++] = j;
+        }
+        if (!k)
+        {
+            continue;
+        }
+
+        cpu_barrier_init(&barrier, k);
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, PERCPU_STACK_SIZE);
+        for (pair_num = 0; pair_num < k; pair_num++)
+        {
+            threads[pair_num].barrier = &barrier;
+            if ((errno = pthread_create(&threads[pair_num].thread, &attr, numa_worker, &threads[pair_num])))
+            {
+                err(1, "pthread_create");
+            }
+        }
+        pthread_attr_destroy(&attr);
+        for (i = 0; i < k; i++)
+        {
+            int cpu_node = (memory[i] - round + n) % n;
+
+            pthread_join(threads[i].thread, NULL);
+            if (threads[i].pinned)
+            {
+                latency[cpu_node * n + memory[i]] = threads[i].latency;
+                bandwidth[cpu_node * n + memory[i]] = threads[i].bandwidth;
+            }
+            bench_free(threads[i].buf, size);
+        }
+        cpu_barrier_destroy(&barrier);
+    }
+
+    /* scaled like the SLIT, where the nearest memory is 10 */
+    for (i = 0; i < n; i++)
+    {
+        double local = 0;
+
+        for (j = 0; j < n; j++)
+        {
+            if ((latency[i * n + j] > 0) && (!local || (latency[i * n + j] < local)))
+            {
+                local = latency[i * n + j];
+            }
+        }
+        for (j = 0; local && (j < n); j++)
+        {
+            if (latency[i * n + j] > 0)
+            {
+                relative[i * n + j] = 10 * latency[i * n + j] / local;
+            }
+        }
+    }
+
+    printf("%-24s %d\n", "NUMA node(s):", n);
+    printf("%-24s %zuM per pair, %d bound, %d first touch\n", "Buffer size:", size >> 20, bound, touched);
+    print_numa_matrix("Latency (ns)", nodes, n, latency);
+    print_numa_matrix("Read bandwidth, one thread (GB/s)", nodes, n, bandwidth);
+    print_numa_matrix("Measured distance", nodes, n, relative);
+    print_numa_matrix("SLIT distance", nodes, n, slit);
+
+    free(latency);
+    free(threads);
+    free(nodes);
+    return;
+}
+
+/*
+ * Round-robin schedule (circle method): CPU n-1 stays put while the others
+ * rotate, so every round is a set of disjoint pairs and n - 1 rounds cover
+ * every pair once. An odd count gets a dummy CPU n, whose partner idles.
+ */
+static int c2c_partner(int cpu, int round, int cpu_num)
+{
+    int n = cpu_num + (cpu_num & 1);
+
+    if (cpu == n - 1)
+    {
+        return round;
+    }
+    if (cpu == round)
+    {
+        return n - 1;
+    }
+    return (2 * round - cpu + 2 * (n - 1)) % (n - 1);
+}
+
+static void *c2c_worker(void *arg)
+{
+    c2c_thread *self = arg;
+    int round = 0, rounds = self->cpu_num + (self->cpu_num & 1) - 1, sample = 0, trip = 0;
+    unsigned int value = 0;
+
+    self->pinned = (bind_to_cpu(self->cpu) == 0);
+    for (round = 0; round < rounds; round++)
+    {
+        int partner = c2c_partner(self->index, round, self->cpu_num);
+        atomic_uint *flag = NULL;
+        uint64_t start = 0, best = 0;
+
+        cpu_barrier_wait(self->barrier);
+        if (partner >= self->cpu_num)
+        {
+            continue;
+        }
+
+        /*
+         * The line is the lower slot's; values only grow from round to round,
+         * so a stale value left by an earlier pair can never match.
+         */
+        flag = &self->lines[MIN(self->index, partner)].flag;
+        value = (unsigned int)round * 2 * C2C_SAMPLES * C2C_ROUND_TRIPS;
+        if (self->index < partner)
+        {
+            for (sample = 0; sample < C2C_SAMPLES; sample++)
+            {
+                start = now_nsec();
+                for (trip = 0; trip < C2C_ROUND_TRIPS; trip++)
+                {
+                    atomic_store_explicit(flag, ++value, memory_order_release);
+                    ++value;
+                    while (atomic_load_explicit(flag, memory_order_acquire) != value)
+                    {
+                        CPU_RELAX();
+                    }
+                }
+                start = now_nsec() - start;
+                if (!best || (start < best))
+                {
+                    best = start;
+                }
+            }
+            self->matrix[self->index * self->cpu_num + partner] = (double)best / C2C_ROUND_TRIPS;
+            self->matrix[partner * self->cpu_num + self->index] = (double)best / C2C_ROUND_TRIPS;
+        }
+        else
+        {
+            for (trip = 0; trip < C2C_SAMPLES * C2C_ROUND_TRIPS; trip++)
+            {
+                ++value;
+                while (atomic_load_explicit(flag, memory_order_acquire) != value)
+                {
+                    CPU_RELAX();
+                }
+                atomic_store_explicit(flag, ++value, memory_order_release);
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Returns how the two CPUs relate: 0 SMT siblings, 1 same L3, 2 same socket, 3 other sockets */
+static int c2c_relation(const percpu_info *a, const percpu_info *b, const x86_cpu_info *x86_info)
+{
+    int i = 0;
+
+    if ((a->package != b->package))
+    {
+        return 3;
+    }
+    if ((a->die == b->die) && (a->module == b->module) && (a->core == b->core))
+    {
+        return 0;
+    }
+    for (i = 0; i < x86_info->cache_num; i++)
+    {
+        const x86_cache *cache = &x86_info->caches[i];
+
+        if ((cache->level == 3) && cache->sharing)
+        {
+            int shift = ceil_log2(cache->sharing);
+
+            return ((percpu_apic_id(a, x86_info) >> shift) == (percpu_apic_id(b, x86_info) >> shift)) ? 1 : 2;
+        }
+    }
+    return 2;
+}
+
+static void run_c2c(const int *cpus, int cpu_num, x86_cpu_info *x86_info)
+{
+    int i = 0, j = 0, k = 0, pinned = 0;
+    static const char *relations[] = {"SMT sibling:", "Same L3:", "Same socket:", "Cross-socket:"};
+    double *matrix = NULL, sum[4] = {0}, low[4] = {0}, high[4] = {0};
+    int count[4] = {0};
+    c2c_thread *threads = NULL;
+    c2c_line *lines = NULL;
+    percpu_info *topology = NULL;
+    cpu_barrier barrier;
+    pthread_attr_t attr;
+    uint64_t start = 0;
+
+    if (cpu_num < 2)
+    {
+        errx(1, "core-to-core latency needs at least two CPUs");
+    }
+    /* the topology sweep first, so its threads don't disturb the timing */
+    topology = collect_percpu_info(cpus, cpu_num, x86_info);
+
+    threads = calloc(cpu_num, sizeof(*threads));
+    matrix = calloc((size_t)cpu_num * cpu_num, sizeof(*matrix));
+    if (!threads || !matrix || posix_memalign((void **)&lines, sizeof(c2c_line), cpu_num * sizeof(*lines)))
+    {
+        err(1, "calloc");
+    }
+    memset(lines, 0, cpu_num * sizeof(*lines));
+
+    start = now_nsec();
+    cpu_barrier_init(&barrier, cpu_num);
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, PERCPU_STACK_SIZE);
+    for (i = 0; i < cpu_num; i++)
+    {
+        threads[i].cpu = cpus[i];
+        threads[i].index = i;
+        threads[i].cpu_num = cpu_num;
+        threads[i].barrier = &barrier;
+        threads[i].lines = lines;
+        threads[i].matrix = matrix;
+        if ((errno = pthread_create(&threads[i].thread, &attr, c2c_worker, &threads[i])))
+        {
+            err(1, "pthread_create");
+        }
+    }
+    pthread_attr_destroy(&attr);
+    for (i = 0; i < cpu_num; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+        pinned += threads[i].pinned;
+    }
+    cpu_barrier_destroy(&barrier);
+    if (pinned != cpu_num)
+    {
+        errx(1, "core-to-core latency needs every thread pinned to its own CPU");
+    }
+
+    printf("Round-trip latency (ns), %d pairs in %d rounds, %.2f s\n",
+            cpu_num * (cpu_num - 1) / 2, cpu_num + (cpu_num & 1) - 1, (now_nsec() - start) / 1e9);
+    printf("%5s", "CPU");
+    for (j = 0; j < cpu_num; j++)
+    {
+        printf(" %5d", cpus[j]);
+    }
+    printf("\n");
+    for (i = 0; i < cpu_num; i++)
+    {
+        printf("%5d", cpus[i]);
+        for (j = 0; j < cpu_num; j++)
+        {
+            if (i == j)
+            {
+                printf(" %5s", "-");
+            }
+            else
+            {
+                printf(" %5.0f", matrix[i * cpu_num + j]);
+            }
+        }
+        printf("\n");
+    }
+
+    if (topology)
+    {
+        for (i = 0; i < cpu_num; i++)
+        {
+            for (j = i + 1; j < cpu_num; j++)
+            {
+                double latency = matrix[i * cpu_num + j];
+
+                if (!topology[i].valid || !topology[j].valid)
+                {
+                    continue;
+                }
+                k = c2c_relation(&topology[i], &topology[j], x86_info);
+                sum[k] += latency;
+                low[k] = count[k] ? MIN(low[k], latency) : latency;
+                high[k] = count[k] ? MAX(high[k], latency) : latency;
+                count[k]++;
+            }
+        }
+        for (k = 0; k < ARRAY_LEN(relations); k++)
+        {
+            if (count[k])
+            {
+                printf("%-24s min %.0f ns, avg %.0f ns, max %.0f ns (%d pairs)\n",
+                        relations[k], low[k], sum[k] / count[k], high[k], count[k]);
+            }
+        }
+        free(topology);
+    }
+
+    free(lines);
+    free(matrix);
+    free(threads);
+    return;
+}
+
+#if defined(__amd64__) || defined(__i386__)
+static uint64_t read_tsc(void)
+{
+    /* keep rdtsc from executing ahead of earlier loads */
+    __builtin_ia32_lfence();
+    return __builtin_ia32_rdtsc();
+}
+
+/* Count TSC ticks against the raw monotonic clock, which NTP doesn't slew */
+static double measure_tsc_hz(void)
+{
+    struct timespec start, end;
+    uint64_t tsc_start = 0, tsc_end = 0, nsec = 0;
+
+    tsc_start = read_tsc();
+    clock_gettime(TSC_REFERENCE_CLOCK, &start);
+    do
+    {
+        clock_gettime(TSC_REFERENCE_CLOCK, &end);
+        nsec = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000 + end.tv_nsec - start.tv_nsec;
+    } while (nsec < TSC_MEASURE_NSEC);
+    tsc_end = read_tsc();
+    return (double)(tsc_end - tsc_start) * 1e9 / nsec;
+}
+
+static void *tsc_responder(void *arg)
+{
+    tsc_probe *probe = arg;
+    int i = 0;
+
+    if (bind_to_cpu(probe->cpu) == -1)
+    {
+        atomic_store_explicit(&probe->line.flag, TSC_PROBE_FAILED, memory_order_release);
+        return NULL;
+    }
+    atomic_store_explicit(&probe->line.flag, TSC_PROBE_READY, memory_order_release);
+    for (i = 0; i < TSC_SAMPLES; i++)
+    {
+        while (atomic_load_explicit(&probe->line.flag, memory_order_acquire) != 2 * i + 1)
+        {
+            CPU_RELAX();
+        }
+        probe->remote[i] = read_tsc();
+        atomic_store_explicit(&probe->line.flag, 2 * i + 2, memory_order_release);
+    }
+    return NULL;
+}
+
+/*
+ * Bracket a read of the other CPU's TSC between two reads of ours. With
+ * synchronized counters it must land inside the bracket; the tightest
+ * bracket estimates the offset to within half its width.
+ */
+static int probe_tsc_skew(int cpu, int64_t *offset, uint64_t *bound, int *violations)
+{
+    int i = 0, best = -1;
+    unsigned int flag = 0;
+    uint64_t before[TSC_SAMPLES], after[TSC_SAMPLES];
+    tsc_probe *probe = NULL;
+    pthread_t thread;
+
+    if (posix_memalign((void **)&probe, C2C_LINE_SIZE, sizeof(*probe)))
+    {
+        return -1;
+    }
+    memset(probe, 0, sizeof(*probe));
+    probe->cpu = cpu;
+    if ((errno = pthread_create(&thread, NULL, tsc_responder, probe)))
+    {
+        free(probe);
+        return -1;
+    }
+
+    while (!(flag = atomic_load_explicit(&probe->line.flag, memory_order_acquire)))
+    {
+        CPU_RELAX();
+    }
+    if (flag == TSC_PROBE_FAILED)
+    {
+        pthread_join(thread, NULL);
+        free(probe);
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    for (i = 0; i < TSC_SAMPLES; i++)
+    {
+        before[i] = read_tsc();
+        atomic_store_explicit(&probe->line.flag, 2 * i + 1, memory_order_release);
+        while (atomic_load_explicit(&probe->line.flag, memory_order_acquire) != 2 * i + 2)
+        {
+            CPU_RELAX();
+        }
+        after[i] = read_tsc();
+    }
+    pthread_join(thread, NULL);
+
+    *violations = 0;
+
+    for (i = 0; i < TSC_SAMPLES; i++)
+    {
+        if ((probe->remote[i] < before[i]) || (probe->remote[i] > after[i]))
+        {
+            (*violations)++;
+        }
+        if ((best == -1) || (after[i] - before[i] < after[best] - before[best]))
+        {
+            best = i;
+        }
+    }
+    *offset = (int64_t)(probe->remote[best] - before[best]) - (int64_t)(after[best] - before[best]) / 2;
+    *bound = (after[best] - before[best]) / 2;
+    free(probe);
+    return 0;
+}
+
+/* Measure the TSC rate on the first allowed CPU and probe every other one against it */
+static void *tsc_measure_worker(void *arg)
+{
+    tsc_measure *job = arg;
+    int i = 0, probed = 0, violations = 0, unsynced = 0;
+    int64_t offset = 0, max_offset = 0;
+    uint64_t bound = 0, max_bound = 0;
+    double measured_hz = 0;
+    char label[32];
+
+    bind_to_cpu(job->cpus[0]);
+    measured_hz = measure_tsc_hz();
+    printf("%-24s %.3f MHz", "Measured TSC frequency:", measured_hz / 1e6);
+    if (job->nominal_hz)
+    {
+        printf(" (%+.0f ppm)", (measured_hz - job->nominal_hz) / job->nominal_hz * 1e6);
+    }
+    printf("\n");
+
+    for (i = 1; i < job->cpu_num; i++)
+    {
+        if (probe_tsc_skew(job->cpus[i], &offset, &bound, &violations) == -1)
+        {
+            continue;
+        }
+        probed++;
+        unsynced += (violations != 0);
+        if (llabs(offset) >= llabs(max_offset))
+        {
+            max_offset = offset;
+            max_bound = bound;
+        }
+        if (violations)
+        {
+            printf("CPU %d: TSC offset %lld cycles (+/-%llu) from CPU %d, %d/%d reads out of order\n",
+                    job->cpus[i], (long long)offset, (unsigned long long)bound, job->cpus[0], violations, TSC_SAMPLES);
+        }
+    }
+    if (probed)
+    {
+        snprintf(label, sizeof(label), "Max skew vs CPU %d:", job->cpus[0]);
+        printf("%-24s %lld cycles (+/-%llu), %d of %d CPUs out of order\n", label,
+                (long long)max_offset, (unsigned long long)max_bound, unsynced, probed);
+    }
+    printf("%-24s %s\n", "Cross-CPU comparable:",
+            (job->invariant && !unsynced && (probed || (job->cpu_num == 1))) ? "yes" :
+            ((job->invariant && !probed) ? "unknown, CPUs can't be pinned" : "no"));
+    return NULL;
+}
+#endif
+
+#if defined(__amd64__) || defined(__i386__)
+static int open_msr(int cpu)
+{
+    char path[PATH_MAX];
+
+#if defined(__linux__)
+    snprintf(path, sizeof(path), "/dev/cpu/%d/msr", cpu);
+    return open(path, O_RDONLY);
+#elif defined(__FreeBSD__) || defined(__DragonFly__)
+    snprintf(path, sizeof(path), "/dev/cpuctl%d", cpu);
+    return open(path, O_RDONLY);
+#else /* no MSR driver */
+    (void)path;
+    (void)cpu;
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
+
+static int read_msr(int fd, uint32_t msr, uint64_t *value)
+{
+#if defined(__linux__)
+    return (pread(fd, value, sizeof(*value), msr) == sizeof(*value)) ? 0 : -1;
+#elif defined(__FreeBSD__) || defined(__DragonFly__)
+    cpuctl_msr_args_t args;
+
+    args.msr = msr;
+    if (ioctl(fd, CPUCTL_RDMSR, &args) == -1)
+    {
+        return -1;
+    }
+    *value = args.data;
+    return 0;
+#else
+    (void)fd;
+    (void)msr;
+    (void)value;
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
+
+/*
+ * WATCH_LOOP_ADDS dependent adds per iteration, one core cycle each. They
+ * add a register to itself, as newer cores fold chains of immediate adds.
+ */
+static uint64_t run_cycle_loop(void)
+{
+    uint64_t start = 0, x = 0, n = WATCH_LOOP_ITERATIONS;
+
+    start = read_tsc();
+    __asm__ __volatile__(
+        "1:\n\t"
+        ".rept 100\n\t"
+        "add %0, %0\n\t"
+        ".endr\n\t"
+        "sub $1, %1\n\t"
+        "jnz 1b\n\t"
+        : "+r"(x), "+r"(n)
+        :
+        : "cc");
+    return read_tsc() - start;
+}
+
+/*
+ * Without MSR access, a thread pinned to each CPU times a fixed chain of
+ * dependent adds with the TSC each interval and sleeps in between.
+ */
+static void *watch_worker(void *arg)
+{
+    watch_cpu *self = arg;
+
+    self->pinned = (bind_to_cpu(self->cpu) == 0);
+    for (;;)
+    {
+        cpu_barrier_wait(self->barrier);
+        if (*self->stop)
+        {
+            break;
+        }
+        self->loop_ticks = run_cycle_loop();
+        cpu_barrier_wait(self->barrier);
+    }
+    return NULL;
+}
+
+static void sleep_nsec(uint64_t nsec)
+{
+    struct timespec ts;
+
+    ts.tv_sec = nsec / 1000000000;
+    ts.tv_nsec = nsec % 1000000000;
+    while ((nanosleep(&ts, &ts) == -1) && (errno == EINTR))
+        ;
+    return;
+}
+
+/*
+ * Print every CPU's effective frequency each interval. With APERF/MPERF
+ * the kernel reads both counters on the target CPU through an IPI, so
+ * every sample wakes every idle CPU out of its C-state for a few
+ * microseconds; the loop fallback keeps each one busy for the loop.
+ */
+static void run_watch(const int *cpu_ids, int cpu_num, x86_cpu_info *x86_info, double interval, long count)
+{
+    int i = 0, msr = 1, stop = 0;
+    long sample = 0;
+    uint64_t interval_nsec = (uint64_t)(interval * 1e9), deadline = 0, tsc = 0, tsc_delta = 0;
+    double tsc_hz = 0;
+    watch_cpu *cpus = calloc(cpu_num, sizeof(*cpus));
+    percpu_info *topology = NULL;
+    cpu_barrier barrier;
+    pthread_attr_t attr;
+
+    if (!cpus)
+    {
+        err(1, "calloc");
+    }
+    topology = collect_percpu_info(cpu_ids, cpu_num, x86_info);
+    tsc_hz = measure_tsc_hz();
+
+    /* cpuid leaf 6 ecx bit 0 */
+    if (!X86_HAS_FEATURE(x86_info, X86_FEATURE_APERFMPERF))
+    {
+        msr = 0;
+    }
+    for (i = 0; i < cpu_num; i++)
+    {
+        cpus[i].cpu = cpu_ids[i];
+        cpus[i].fd = msr ? open_msr(cpu_ids[i]) : -1;
+        if ((cpus[i].fd == -1) || (read_msr(cpus[i].fd, MSR_IA32_APERF, &cpus[i].aperf) == -1) ||
+            (read_msr(cpus[i].fd, MSR_IA32_MPERF, &cpus[i].mperf) == -1))
+        {
+            msr = 0;
+        }
+    }
+
+    if (!msr)
+    {
+        cpu_barrier_init(&barrier, cpu_num + 1);
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, PERCPU_STACK_SIZE);
+        for (i = 0; i < cpu_num; i++)
+        {
+            if (cpus[i].fd != -1)
+            {
+                close(cpus[i].fd);
+            }
+            cpus[i].barrier = &barrier;
+            cpus[i].stop = &stop;
+            if ((errno = pthread_create(&cpus[i].thread, &attr, watch_worker, &cpus[i])))
+            {
+                err(1, "pthread_create");
+            }
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    printf("Sampling %s every %.3f s, TSC %.0f MHz\n", msr ? "APERF/MPERF" : "a calibrated loop",
+            interval, tsc_hz / 1e6);
+    tsc = read_tsc();
+    deadline = now_nsec();
+    for (sample = 0; !count || (sample < count); sample++)
+    {
+        deadline += interval_nsec;
+        sleep_nsec(MAX((int64_t)(deadline - now_nsec()), 0));
+        if (!msr)
+        {
+            /* release the workers, then wait for their loops */
+            cpu_barrier_wait(&barrier);
+            cpu_barrier_wait(&barrier);
+        }
+        tsc_delta = read_tsc() - tsc;
+        tsc += tsc_delta;
+
+        printf("%-9s %-5s %-7s %-5s %-8s %-6s %s\n", "Time", "CPU", "Socket", "Core", "Avg_MHz", "Busy%", "Bzy_MHz");
+        for (i = 0; i < cpu_num; i++)
+        {
+            watch_cpu *cpu = &cpus[i];
+            char socket[16] = "-", core[16] = "-";
+
+            if (topology && topology[i].valid)
+            {
+                snprintf(socket, sizeof(socket), "%u", topology[i].package);
+                snprintf(core, sizeof(core), "%u", topology[i].core);
+            }
+            printf("%-9.3f %-5d %-7s %-5s ", (sample + 1) * interval, cpu->cpu, socket, core);
+            if (msr)
+            {
+                uint64_t aperf = 0, mperf = 0;
+
+                if ((read_msr(cpu->fd, MSR_IA32_APERF, &aperf) == -1) ||
+                    (read_msr(cpu->fd, MSR_IA32_MPERF, &mperf) == -1) || (mperf == cpu->mperf))
+                {
+                    printf("%-8s %-6s %s\n", "-", "-", "-");
+                    continue;
+                }
+                /* MPERF ticks at the TSC rate, but only in C0 */
+                printf("%-8.0f %-6.1f %.0f\n", (aperf - cpu->aperf) * tsc_hz / tsc_delta / 1e6,
+                        100.0 * (mperf - cpu->mperf) / tsc_delta, tsc_hz * (aperf - cpu->aperf) / (mperf - cpu->mperf) / 1e6);
+                cpu->aperf = aperf;
+                cpu->mperf = mperf;
+            }
+            else if (cpu->pinned && cpu->loop_ticks)
+            {
+                printf("%-8s %-6s %.0f\n", "-", "-",
+                        tsc_hz * WATCH_LOOP_ITERATIONS * WATCH_LOOP_ADDS / cpu->loop_ticks / 1e6);
+            }
+            else
+            {
+                printf("%-8s %-6s %s\n", "-", "-", "-");
+            }
+        }
+        fflush(stdout);
+    }
+
+    if (!msr)
+    {
+        stop = 1;
+        cpu_barrier_wait(&barrier);
+        for (i = 0; i < cpu_num; i++)
+        {
+            pthread_join(cpus[i].thread, NULL);
+        }
+        cpu_barrier_destroy(&barrier);
+    }
+    else
+    {
+        for (i = 0; i < cpu_num; i++)
+        {
+            close(cpus[i].fd);
+        }
+    }
+    free(topology);
+    free(cpus);
+    return;
+}
+
+/* Keep the FMA units busy with six independent chains of 256-bit FMAs */
+static void turbo_avx2_kernel(void)
+{
+    __asm__ __volatile__(
+        "vxorps %%ymm0, %%ymm0, %%ymm0\n\t"
+        "vmovaps %%ymm0, %%ymm1\n\t"
+        "vmovaps %%ymm0, %%ymm2\n\t"
+        "vmovaps %%ymm0, %%ymm3\n\t"
+        "vmovaps %%ymm0, %%ymm4\n\t"
+        "vmovaps %%ymm0, %%ymm5\n\t"
+        "vmovaps %%ymm0, %%ymm6\n\t"
+        "vmovaps %%ymm0, %%ymm7\n\t"
+        "mov %0, %%ecx\n\t"
+        "1:\n\t"
+        ".rept 16\n\t"
+        "vfmadd231ps %%ymm6, %%ymm7, %%ymm0\n\t"
+        "vfmadd231ps %%ymm6, %%ymm7, %%ymm1\n\t"
+        "vfmadd231ps %%ymm6, %%ymm7, %%ymm2\n\t"
+        "vfmadd231ps %%ymm6, %%ymm7, %%ymm3\n\t"
+        "vfmadd231ps %%ymm6, %%ymm7, %%ymm4\n\t"
+        "vfmadd231ps %%ymm6, %%ymm7, %%ymm5\n\t"
+        ".endr\n\t"
+        "dec %%ecx\n\t"
+        "jnz 1b\n\t"
+        "vzeroupper\n\t"
+        :
+        : "i"(TURBO_KERNEL_ITERATIONS)
+        : "ecx", "cc", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7");
+    return;
+}
+
+static void turbo_avx512_kernel(void)
+{
+    __asm__ __volatile__(
+        "vpxord %%zmm0, %%zmm0, %%zmm0\n\t"
+        "vmovaps %%zmm0, %%zmm1\n\t"
+        "vmovaps %%zmm0, %%zmm2\n\t"
+        "vmovaps %%zmm0, %%zmm3\n\t"
+        "vmovaps %%zmm0, %%zmm4\n\t"
+        "vmovaps %%zmm0, %%zmm5\n\t"
+        "vmovaps %%zmm0, %%zmm6\n\t"
+        "vmovaps %%zmm0, %%zmm7\n\t"
+        "mov %0, %%ecx\n\t"
+        "1:\n\t"
+        ".rept 16\n\t"
+        "vfmadd231ps %%zmm6, %%zmm7, %%zmm0\n\t"
+        "vfmadd231ps %%zmm6, %%zmm7, %%zmm1\n\t"
+        "vfmadd231ps %%zmm6, %%zmm7, %%zmm2\n\t"
+        "vfmadd231ps %%zmm6, %%zmm7, %%zmm3\n\t"
+        "vfmadd231ps %%zmm6, %%zmm7, %%zmm4\n\t"
+        "vfmadd231ps %%zmm6, %%zmm7, %%zmm5\n\t"
+        ".endr\n\t"
+        "dec %%ecx\n\t"
+        "jnz 1b\n\t"
+        "vzeroupper\n\t"
+        :
+        : "i"(TURBO_KERNEL_ITERATIONS)
+        : "ecx", "cc", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7");
+    return;
+}
+
+/*
+ * Run the load kernel and sample the frequency with the calibrated add
+ * loop in between; the AVX frequency license outlasts the short sample.
+ */
+static void *turbo_worker(void *arg)
+{
+    turbo_thread *self = arg;
+    uint64_t ticks = 0;
+
+    self->pinned = (bind_to_cpu(self->cpu) == 0);
+    while (!atomic_load_explicit(self->stop, memory_order_relaxed))
+    {
+        switch (self->kernel)
+        {
+            case TURBO_AVX2:
+            {
+                turbo_avx2_kernel();
+                break;
+            }
+            case TURBO_AVX512:
+            {
+                turbo_avx512_kernel();
+                break;
+            }
+            default:
+            {
+                break;
+            }
+        }
+        ticks = run_cycle_loop();
+        if (atomic_load_explicit(self->measure, memory_order_relaxed))
+        {
+            self->ticks += ticks;
+            self->samples++;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Order the CPUs one per physical core first, then their SMT siblings;
+ * smt holds the rank among the allowed siblings, not the SMT ID.
+ */
+static int compare_turbo_cpu(const void *a, const void *b)
+{
+    const percpu_info *x = a, *y = b;
+    uint64_t kx = 0, ky = 0;
+
+    if (x->valid != y->valid)
+    {
+        return y->valid - x->valid;
+    }
+    kx = ((uint64_t)x->smt << 56) | ((uint64_t)x->package << 40) | ((uint64_t)x->die << 32) |
+            ((uint64_t)x->module << 16) | x->core;
+    ky = ((uint64_t)y->smt << 56) | ((uint64_t)y->package << 40) | ((uint64_t)y->die << 32) |
+            ((uint64_t)y->module << 16) | y->core;
+    return (kx > ky) - (kx < ky);
+}
+
+static void run_turbo_curve(const int *cpus, int cpu_num, x86_cpu_info *x86_info)
+{
+    int i = 0, j = 0, kernel = 0, active = 0, valid = 0;
+    unsigned int *rank = calloc(cpu_num, sizeof(*rank));
+    static const char *kernels[TURBO_KERNELS] = {"scalar", "avx2", "avx512"};
+    int supported[TURBO_KERNELS];
+    double tsc_hz = 0;
+    percpu_info *order = NULL;
+    turbo_thread *threads = calloc(cpu_num, sizeof(*threads));
+    atomic_int stop, measure;
+    pthread_attr_t attr;
+
+    if (!threads || !rank)
+    {
+        err(1, "calloc");
+    }
+    if (!(order = collect_percpu_info(cpus, cpu_num, x86_info)))
+    {
+        errx(1, "the frequency curve needs thread affinity support");
+    }
+    /*
+     * A core whose only allowed CPU is its second thread still gets one
+     * of the first slots, so rank each CPU among its allowed siblings.
+     */
+    for (i = 0; i < cpu_num; i++)
+    {
+        for (j = 0; j < cpu_num; j++)
+        {
+            if (order[i].valid && order[j].valid && (order[j].package == order[i].package) &&
+                    (order[j].die == order[i].die) && (order[j].module == order[i].module) &&
+                    (order[j].core == order[i].core) && (order[j].smt < order[i].smt))
+            {
+                rank[i]++;
+            }
+        }
+    }
+    for (i = 0; i < cpu_num; i++)
+    {
+        order[i].smt = rank[i];
+    }
+    free(rank);
+    qsort(order, cpu_num, sizeof(*order), compare_turbo_cpu);
+    for (valid = 0; (valid < cpu_num) && order[valid].valid; valid++)
+        ;
+
+    supported[TURBO_SCALAR] = 1;
+    supported[TURBO_AVX2] = X86_HAS_FEATURE(x86_info, X86_FEATURE_AVX2) && X86_HAS_FEATURE(x86_info, X86_FEATURE_FMA);
+    supported[TURBO_AVX512] = X86_HAS_FEATURE(x86_info, X86_FEATURE_AVX512F);
+    tsc_hz = measure_tsc_hz();
+
+    printf("%-8s %-7s %-8s %-8s %s\n", "Kernel", "Active", "Avg_MHz", "Min_MHz", "Max_MHz");
+    for (kernel = 0; kernel < TURBO_KERNELS; kernel++)
+    {
+        if (!supported[kernel])
+        {
+            printf("%-8s %s\n", kernels[kernel], "not supported");
+            continue;
+        }
+        /* 1, 2, 4 ... active CPUs, always ending with all of them */
+        for (active = 1; active <= valid; active = (active < valid) ? MIN(active * 2, valid) : valid + 1)
+        {
+            double sum = 0, low = 0, high = 0;
+
+            atomic_init(&stop, 0);
+            atomic_init(&measure, 0);
+            pthread_attr_init(&attr);
+            pthread_attr_setstacksize(&attr, PERCPU_STACK_SIZE);
+            for (i = 0; i < active; i++)
+            {
+                memset(&threads[i], 0, sizeof(threads[i]));
+                threads[i].cpu = order[i].cpu;
+                threads[i].kernel = kernel;
+                threads[i].stop = &stop;
+                threads[i].measure = &measure;
+                if ((errno = pthread_create(&threads[i].thread, &attr, turbo_worker, &threads[i])))
+                {
+                    err(1, "pthread_create");
+                }
+            }
+            pthread_attr_destroy(&attr);
+
+            /* let the clocks settle before sampling */
+            sleep_nsec(TURBO_WARMUP_NSEC);
+            atomic_store(&measure, 1);
+            sleep_nsec(TURBO_MEASURE_NSEC);
+            atomic_store(&stop, 1);
+
+            for (i = 0; i < active; i++)
+            {
+                double mhz = 0;
+
+                pthread_join(threads[i].thread, NULL);
+                if (threads[i].samples)
+                {
+                    mhz = tsc_hz * threads[i].samples * WATCH_LOOP_ITERATIONS * WATCH_LOOP_ADDS / threads[i].ticks / 1e6;
+                }
+                sum += mhz;
+                low = i ? MIN(low, mhz) : mhz;
+                high = i ? MAX(high, mhz) : mhz;
+            }
+            printf("%-8s %-7d %-8.0f %-8.0f %.0f\n", kernels[kernel], active, sum / active, low, high);
+            fflush(stdout);
+
+            /* give the power budget a moment to recover */
+            sleep_nsec(TURBO_REST_NSEC);
+        }
+    }
+    free(order);
+    free(threads);
+    return;
+}
+
+SIMD_KERNEL(simd_sse_fp, SIMD_SSE_ZERO, SIMD_SSE_FP, "")
+SIMD_KERNEL(simd_sse_int, SIMD_SSE_ZERO, SIMD_SSE_INT, "")
+SIMD_KERNEL(simd_sse_shuf, SIMD_SSE_ZERO, SIMD_SSE_SHUF, "")
+SIMD_KERNEL(simd_avx2_fp, SIMD_AVX2_ZERO, SIMD_AVX2_FP, "vzeroupper\n\t")
+SIMD_KERNEL(simd_avx2_int, SIMD_AVX2_ZERO, SIMD_AVX2_INT, "vzeroupper\n\t")
+SIMD_KERNEL(simd_avx2_shuf, SIMD_AVX2_ZERO, SIMD_AVX2_SHUF, "vzeroupper\n\t")
+SIMD_KERNEL(simd_avx512_fp, SIMD_AVX512_ZERO, SIMD_AVX512_FP, "vzeroupper\n\t")
+SIMD_KERNEL(simd_avx512_int, SIMD_AVX512_ZERO, SIMD_AVX512_INT, "vzeroupper\n\t")
+SIMD_KERNEL(simd_avx512_shuf, SIMD_AVX512_ZERO, SIMD_AVX512_SHUF, "vzeroupper\n\t")
+
+/*
+ * Instructions per core clock. Each run is followed by the calibrated add
+ * loop, so the cycle count holds at whatever clock the kernel's frequency
+ * license left the core in; the fastest of SIMD_REPEATS runs of each
+ * drops the ones that were interrupted.
+ */
+static double measure_simd_ipc(const simd_kernel *kernel)
+{
+    int rep = 0;
+    uint64_t start = 0, ticks = 0, loop_ticks = 0, best = 0, best_loop = 0;
+
+    for (rep = 0; rep < SIMD_REPEATS; rep++)
+    {
+        start = read_tsc();
+        kernel->run();
+        ticks = read_tsc() - start;
+        loop_ticks = run_cycle_loop();
+        best = rep ? MIN(best, ticks) : ticks;
+        best_loop = rep ? MIN(best_loop, loop_ticks) : loop_ticks;
+    }
+    if (!best)
+    {
+        return 0;
+    }
+    return (double)SIMD_KERNEL_ITERATIONS * SIMD_KERNEL_INSNS * best_loop /
+            ((double)best * WATCH_LOOP_ITERATIONS * WATCH_LOOP_ADDS);
+}
+
+static void *simd_worker(void *arg)
+{
+    simd_thread *self = arg;
+
+    self->pinned = (bind_to_cpu(self->cpu) == 0);
+    cpu_barrier_wait(self->barrier);
+    self->ipc = measure_simd_ipc(self->kernel);
+    return NULL;
+}
+
+/* Run the kernel on every thread at once, returns the summed IPC */
+static double run_simd_threads(simd_thread *threads, int thread_num, const simd_kernel *kernel)
+{
+    int i = 0;
+    double sum = 0;
+    cpu_barrier barrier;
+    pthread_attr_t attr;
+
+    cpu_barrier_init(&barrier, thread_num);
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, PERCPU_STACK_SIZE);
+    for (i = 0; i < thread_num; i++)
+    {
+        threads[i].kernel = kernel;
+        threads[i].barrier = &barrier;
+        threads[i].ipc = 0;
+        if ((errno = pthread_create(&threads[i].thread, &attr, simd_worker, &threads[i])))
+        {
+            err(1, "pthread_create");
+        }
+    }
+    pthread_attr_destroy(&attr);
+
+    for (i = 0; i < thread_num; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+        sum += threads[i].ipc;
+    }
+    cpu_barrier_destroy(&barrier);
+    return sum;
+}
+
+/*
+ * Throughput of floating point, integer and shuffle kernels for each
+ * vector width the CPU and OS support, on one CPU and on all of them.
+ */
+static void run_simd_bench(const int *cpus, int cpu_num, x86_cpu_info *x86_info)
+{
+    static const simd_kernel kernels[] = {
+        {"sse", "mul", simd_sse_fp, X86_FEATURE_SSE2, 4},
+        {"sse", "int", simd_sse_int, X86_FEATURE_SSE2, 4},
+        {"sse", "shuffle", simd_sse_shuf, X86_FEATURE_SSE2, 4},
+        {"avx2", "fma", simd_avx2_fp, X86_FEATURE_FMA, 16},
+        {"avx2", "int", simd_avx2_int, X86_FEATURE_AVX2, 8},
+        {"avx2", "shuffle", simd_avx2_shuf, X86_FEATURE_AVX2, 8},
+        {"avx512", "fma", simd_avx512_fp, X86_FEATURE_AVX512F, 32},
+        {"avx512", "int", simd_avx512_int, X86_FEATURE_AVX512F, 16},
+        {"avx512", "shuffle", simd_avx512_shuf, X86_FEATURE_AVX512F, 16},
+    };
+    int i = 0, pinned = 0;
+    double ipc = 0, all = 0;
+    simd_thread *threads = NULL;
+
+    if (!(threads = calloc((size_t)cpu_num, sizeof(*threads))))
+    {
+        err(1, "calloc");
+    }
+    for (i = 0; i < cpu_num; i++)
+    {
+        threads[i].cpu = cpus[i];
+    }
+
+    printf("%-8s %-8s %-6s %-10s %-10s %-10s %s\n",
+            "Tier", "Kernel", "IPC", "Ops/cycle", "All_IPC", "All_ops", "All_ops/CPU");
+    for (i = 0; i < ARRAY_LEN(kernels); i++)
+    {
+        const simd_kernel *kernel = &kernels[i];
+
+        if (!X86_HAS_FEATURE(x86_info, kernel->feature))
+        {
+            printf("%-8s %-8s %s\n", kernel->tier, kernel->name, "not supported");
+            continue;
+        }
+        ipc = run_simd_threads(threads, 1, kernel);
+        all = run_simd_threads(threads, cpu_num, kernel);
+        printf("%-8s %-8s %-6.2f %-10.1f %-10.2f %-10.1f %.1f\n", kernel->tier, kernel->name,
+                ipc, ipc * kernel->lane_ops, all / cpu_num, all * kernel->lane_ops, all * kernel->lane_ops / cpu_num);
+        fflush(stdout);
+    }
+
+    for (i = 0; i < cpu_num; i++)
+    {
+        pinned += threads[i].pinned;
+    }
+    if (pinned < cpu_num)
+    {
+        printf("%d of %d threads could not be pinned, all-core results are approximate\n", cpu_num - pinned, cpu_num);
+    }
+    free(threads);
+    return;
+}
+#endif
+
+/* Crystal frequencies of parts whose leaf 0x15 leaves ecx zero (Intel SDM) */
+static uint32_t intel_crystal_hz(const x86_cpu_info *x86_info)
+{
+    if (x86_info->family != 6)
+    {
+        return 0;
+    }
+    switch (x86_info->model)
+    {
+        case 0x4E:
+        case 0x5E:
+        case 0x8E:
+        case 0x9E:
+        {
+            return 24000000;
+        }
+        case 0x55:
+        {
+            return 25000000;
+        }
+        case 0x5C:
+        {
+            return 19200000;
+        }
+        default:
+        {
+            return 0;
+        }
+    }
+}
+
+static void print_tsc_info(const cpuid_table *table, const x86_cpu_info *x86_info, const int *cpus, int cpu_num, int measure)
+{
+    const uint32_t *regs = NULL;
+    int invariant = X86_HAS_FEATURE(x86_info, X86_FEATURE_NONSTOP_TSC);
+    uint32_t crystal_hz = 0;
+    double nominal_hz = 0;
+
+    if (!X86_HAS_FEATURE(x86_info, X86_FEATURE_TSC))
+    {
+        printf("%-24s %s\n", "TSC:", "none");
+        return;
+    }
+    /* 0x80000007 edx bit 8: constant rate in every P-, C- and T-state */
+    printf("%-24s %s\n", "TSC:", invariant ? "invariant" : "not invariant");
+
+    if ((regs = cpuid_table_regs(table, 0x15, 0)) && regs[CPUID_EAX] && regs[CPUID_EBX])
+    {
+        const uint32_t *freq = cpuid_table_regs(table, 0x16, 0);
+
+        crystal_hz = regs[CPUID_ECX] ? regs[CPUID_ECX] : intel_crystal_hz(x86_info);
+        if (!crystal_hz && freq && freq[CPUID_EAX])
+        {
+            /* derive the crystal from the base frequency */
+            crystal_hz = (uint32_t)((uint64_t)freq[CPUID_EAX] * 1000000 * regs[CPUID_EAX] / regs[CPUID_EBX]);
+        }
+        printf("%-24s %u/%u\n", "TSC/crystal ratio:", regs[CPUID_EBX], regs[CPUID_EAX]);
+        if (crystal_hz)
+        {
+            nominal_hz = (double)crystal_hz * regs[CPUID_EBX] / regs[CPUID_EAX];
+            printf("%-24s %.3f MHz\n", "Crystal clock:", crystal_hz / 1e6);
+            printf("%-24s %.3f MHz\n", "Nominal TSC frequency:", nominal_hz / 1e6);
+        }
+    }
+    if ((regs = cpuid_table_regs(table, 0x16, 0)) && regs[CPUID_EAX])
+    {
+        printf("%-24s %u MHz base, %u MHz max, %u MHz bus\n", "Processor frequency:",
+                regs[CPUID_EAX], regs[CPUID_EBX], regs[CPUID_ECX]);
+    }
+    /* VMware and KVM publish the TSC rate they give the guest */
+    if (X86_HAS_FEATURE(x86_info, X86_FEATURE_HYPERVISOR) &&
+        (regs = cpuid_table_regs(table, 0x40000000, 0)) && (regs[CPUID_EAX] >= 0x40000010) &&
+        (regs = cpuid_table_regs(table, 0x40000010, 0)) && regs[CPUID_EAX])
+    {
+        printf("%-24s %.3f MHz\n", "Hypervisor TSC:", regs[CPUID_EAX] / 1e3);
+    }
+
+#if defined(__amd64__) || defined(__i386__)
+    if (measure)
+    {
+        tsc_measure job;
+        pthread_t thread;
+
+        job.cpus = cpus;
+        job.cpu_num = cpu_num;
+        job.invariant = invariant;
+        job.nominal_hz = nominal_hz;
+        /* a thread of its own pins to the reference CPU, so ours keeps its affinity */
+        if ((errno = pthread_create(&thread, NULL, tsc_measure_worker, &job)))
+        {
+            err(1, "pthread_create");
+        }
+        pthread_join(thread, NULL);
+    }
+#endif
+    return;
+}
+
+/* Execute one of the operations that exits or slows down in a guest */
+static void run_virt_op(int op, int count, volatile char *pages, long page_size)
+{
+    int i = 0;
+    uintptr_t sum = 0;
+    struct timespec ts;
+
+    switch (op)
+    {
+#if defined(__amd64__) || defined(__i386__)
+        case VIRT_CPUID:
+        {
+            uint32_t eax, ebx, ecx, edx;
+
+            for (i = 0; i < count; i++)
+            {
+                __cpuid_count(0, 0, eax, ebx, ecx, edx);
+                sum += eax;
+            }
+            break;
+        }
+        case VIRT_RDTSC:
+        {
+            for (i = 0; i < count; i++)
+            {
+                sum += __builtin_ia32_rdtsc();
+            }
+            break;
+        }
+        case VIRT_RDTSCP:
+        {
+            unsigned int aux = 0;
+
+            for (i = 0; i < count; i++)
+            {
+                sum += __builtin_ia32_rdtscp(&aux);
+            }
+            break;
+        }
+#endif
+        case VIRT_CLOCK:
+        {
+            for (i = 0; i < count; i++)
+            {
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                sum += ts.tv_nsec;
+            }
+            break;
+        }
+        case VIRT_SYSCALL:
+        {
+            /* libc doesn't cache it, so every call enters the kernel */
+            for (i = 0; i < count; i++)
+            {
+                sum += getppid();
+            }
+            break;
+        }
+        case VIRT_PAGE_FAULT:
+        {
+            for (i = 0; i < count; i++)
+            {
+                pages[i * page_size] = 1;
+            }
+            break;
+        }
+        default:
+        {
+            break;
+        }
+    }
+    bench_sink = sum;
+    return;
+}
+
+/* Cost per operation of the fastest and the median of VIRT_BATCHES batches */
+static int measure_virt_op(int op, double *best, double *median)
+{
+    int i = 0, count = (op == VIRT_PAGE_FAULT) ? VIRT_FAULT_PAGES : VIRT_BATCH_OPS;
+    long page_size = sysconf(_SC_PAGESIZE);
+    uint64_t nsec[VIRT_BATCHES], start = 0;
+    char *pages = NULL;
+
+    for (i = 0; i < VIRT_BATCHES; i++)
+    {
+        if (op == VIRT_PAGE_FAULT)
+        {
+            pages = mmap(NULL, count * page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+            if (pages == MAP_FAILED)
+            {
+                return -1;
+            }
+        }
+        start = now_nsec();
+        run_virt_op(op, count, pages, page_size);
+        nsec[i] = now_nsec() - start;
+        if (op == VIRT_PAGE_FAULT)
+        {
+            munmap(pages, count * page_size);
+        }
+    }
+    qsort(nsec, VIRT_BATCHES, sizeof(nsec[0]), compare_uint64);
+    *best = (double)nsec[0] / count;
+    *median = (double)nsec[VIRT_BATCHES / 2] / count;
+    return 0;
+}
+
+static void print_virt_info(const cpuid_table *table, const x86_cpu_info *x86_info, int measure)
+{
+    static const struct
+    {
+        const char *signature;
+        const char *name;
+    } hypervisors[] = {
+        {"KVMKVMKVM", "KVM"},
+        {"Linux KVM Hv", "KVM (Hyper-V interface)"},
+        {"Microsoft Hv", "Microsoft Hyper-V"},
+        {"VMwareVMware", "VMware"},
+        {"XenVMMXenVMM", "Xen"},
+        {"TCGTCGTCGTCG", "QEMU TCG"},
+        {" lrpepyh  vr", "Parallels"},
+        {"VBoxVBoxVBox", "VirtualBox"},
+        {"bhyve bhyve ", "bhyve"},
+        {"OpenBSDVMM58", "OpenBSD vmm"},
+        {"___ NVMM ___", "NetBSD NVMM"},
+        {"ACRNACRNACRN", "ACRN"},
+    };
+    /* KVM leaf 0x40000001 eax and Hyper-V leaf 0x40000003 eax */
+    static const char *kvm_features[32] = {
+        "clocksource", "nop_io_delay", "mmu_op", "clocksource2", "async_pf", "steal_time",
+        "pv_eoi", "pv_unhalt", NULL, "pv_tlb_flush", "async_pf_vmexit", "pv_send_ipi",
+        "poll_control", "pv_sched_yield", "async_pf_int", "msi_ext_dest_id",
+        "hc_map_gpa_range", "migration_control", NULL, NULL, NULL, NULL, NULL, NULL,
+        "clocksource_stable",
+    };
+    static const char *hyperv_features[32] = {
+        "vp_runtime", "time_ref_count", "synic", "stimer", "apic_access", "hypercall",
+        "vp_index", "reset", "stats", "reference_tsc", "guest_idle", "frequency_msrs",
+        "debug_msrs", "reenlightenment",
+    };
+    static const char *ops[VIRT_OPS] = {"CPUID:", "RDTSC:", "RDTSCP:", "clock_gettime:", "Syscall:", "Page fault:"};
+    const char **features = NULL;
+    const uint32_t *regs = NULL;
+    char signature[13], list[X86_FLAGS_LEN];
+    const char *name = "unknown";
+    int i = 0, n = 0;
+    uint32_t bits = 0;
+    double best = 0, median = 0;
+
+    if (!X86_HAS_FEATURE(x86_info, X86_FEATURE_HYPERVISOR))
+    {
+        printf("%-24s %s\n", "Hypervisor:", "none");
+    }
+    else if (!(regs = cpuid_table_regs(table, 0x40000000, 0)))
+    {
+        printf("%-24s %s\n", "Hypervisor:", "present, no CPUID leaves");
+    }
+    else
+    {
+        memcpy(signature, &regs[CPUID_EBX], 4);
+        memcpy(&signature[4], &regs[CPUID_ECX], 4);
+        memcpy(&signature[8], &regs[CPUID_EDX], 4);
+        signature[12] = '\0';
+        for (i = 0; i < ARRAY_LEN(hypervisors); i++)
+        {
+            if (!strcmp(signature, hypervisors[i].signature))
+            {
+                name = hypervisors[i].name;
+                break;
+            }
+        }
+        printf("%-24s %s (\"%s\")\n", "Hypervisor:", name, signature);
+        printf("%-24s 0x%08x\n", "Hypervisor max leaf:", regs[CPUID_EAX] ? regs[CPUID_EAX] : 0x40000001);
+
+        if (!strcmp(signature, "KVMKVMKVM") && (regs = cpuid_table_regs(table, 0x40000001, 0)))
+        {
+            features = kvm_features;
+            bits = regs[CPUID_EAX];
+        }
+        else if (!strcmp(signature, "Microsoft Hv") && (regs = cpuid_table_regs(table, 0x40000003, 0)))
+        {
+            features = hyperv_features;
+            bits = regs[CPUID_EAX];
+        }
+        else if (!strcmp(signature, "XenVMMXenVMM") && (regs = cpuid_table_regs(table, 0x40000001, 0)))
+        {
+            printf("%-24s %u.%u\n", "Xen version:", regs[CPUID_EAX] >> 16, regs[CPUID_EAX] & 0xFFFF);
+        }
+
+        if (features)
+        {
+            list[0] = '\0';
+            for (i = 0; i < 32; i++)
+            {
+                if ((bits & (1U << i)) && features[i])
+                {
+                    n += snprintf(list + n, (n < sizeof(list)) ? sizeof(list) - n : 0, "%s%s", n ? " " : "", features[i]);
+                }
+            }
+            printf("%-24s %s\n", "Paravirt features:", n ? list : "none");
+        }
+    }
+
+    if (!measure)
+    {
+        return;
+    }
+    /* the same costs on bare metal are the baseline to compare guests with */
+    for (i = 0; i < VIRT_OPS; i++)
+    {
+#if defined(__amd64__) || defined(__i386__)
+        if (((i == VIRT_RDTSC) && !X86_HAS_FEATURE(x86_info, X86_FEATURE_TSC)) ||
+            ((i == VIRT_RDTSCP) && !X86_HAS_FEATURE(x86_info, X86_FEATURE_RDTSCP)))
+        {
+            continue;
+        }
+#else
+        if (i <= VIRT_RDTSCP)
+        {
+            continue;
+        }
+#endif
+        if (measure_virt_op(i, &best, &median) == -1)
+        {
+            warn("%s", ops[i]);
+            continue;
+        }
+        printf("%-24s %.1f ns (median %.1f ns)\n", ops[i], best, median);
+    }
+    return;
+}
+
+static uint64_t cpu_nsec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Start timing a phase of the run, nested phases pass a larger depth.
+ * Returns the id for timing_end(), or -1 when --timings is off.
+ */
+static int timing_begin(const char *name, int depth)
+{
+    timing_phase *phase = NULL;
+
+    if (!timing_enabled || (timing_num == TIMING_MAX_PHASES))
+    {
+        return -1;
+    }
+    phase = &timings[timing_num];
+    phase->name = name;
+    phase->depth = depth;
+    phase->wall_start = now_nsec();
+    phase->cpu_start = cpu_nsec();
+    return timing_num++;
+}
+
+static void timing_end(int id)
+{
+    if (id == -1)
+    {
+        return;
+    }
+    timings[id].wall_nsec = now_nsec() - timings[id].wall_start;
+    timings[id].cpu_nsec = cpu_nsec() - timings[id].cpu_start;
+    return;
+}
+
+static void print_timings(uint64_t wall_start, uint64_t cpu_start)
+{
+    int i = 0;
+    char name[32];
+
+    printf("%-28s %-10s %s\n", "Phase", "Wall_us", "CPU_us");
+    for (i = 0; i < timing_num; i++)
+    {
+        snprintf(name, sizeof(name), "%*s%s", timings[i].depth * 2, "", timings[i].name);
+        printf("%-28s %-10.1f %.1f\n", name, timings[i].wall_nsec / 1000.0, timings[i].cpu_nsec / 1000.0);
+    }
+    printf("%-28s %-10.1f %.1f\n", "total", (now_nsec() - wall_start) / 1000.0, (cpu_nsec() - cpu_start) / 1000.0);
+    return;
+}
+
+/*
+ * Run the default invocation, cached and with -n, as separate processes
+ * and report the end-to-end latency percentiles.
+ */
+static void run_startup_bench(const char *self, int runs)
+{
+    static const char *modes[][2] = {{"cached", NULL}, {"no snapshot", "-n"}};
+    int i = 0, mode = 0, status = 0, null_fd = -1;
+    uint64_t *nsec = calloc((size_t)runs, sizeof(*nsec)), start = 0;
+    pid_t pid;
+
+    if (!nsec)
+    {
+        err(1, "calloc");
+    }
+    if ((null_fd = open("/dev/null", O_WRONLY)) == -1)
+    {
+        err(1, "/dev/null");
+    }
+
+    printf("%-12s %-6s %-10s %-10s %-10s %s\n", "Mode", "Runs", "Min_us", "p50_us", "p99_us", "Max_us");
+    for (mode = 0; mode < ARRAY_LEN(modes); mode++)
+    {
+        for (i = 0; i < runs; i++)
+        {
+            start = now_nsec();
+            if ((pid = fork()) == -1)
+            {
+                err(1, "fork");
+            }
+            if (!pid)
+            {
+                dup2(null_fd, STDOUT_FILENO);
+                execlp(self, self, modes[mode][1], (char *)NULL);
+                _exit(127);
+            }
+            if ((waitpid(pid, &status, 0) == -1) || !WIFEXITED(status) || WEXITSTATUS(status))
+            {
+                errx(1, "%s exited abnormally", self);
+            }
+            nsec[i] = now_nsec() - start;
+        }
+        qsort(nsec, runs, sizeof(nsec[0]), compare_uint64);
+        printf("%-12s %-6d %-10.1f %-10.1f %-10.1f %.1f\n", modes[mode][0], runs, nsec[0] / 1000.0,
+                nsec[runs / 2] / 1000.0, nsec[MIN(runs * 99 / 100, runs - 1)] / 1000.0, nsec[runs - 1] / 1000.0);
+        fflush(stdout);
+    }
+    close(null_fd);
+    free(nsec);
+    return;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: lscpu [-B|--bench-simd] [-C|--caches] [-e|--extended] [-F|--freq-curve] [-g|--cache-groups]\n"
+                    "             [-h|--help] [-I|--isolation] [-M|--bench-memory] [-m|--bench-numa] [-N|--numa]\n"
+                    "             [-n|--no-snapshot] [-P|--parallelism] [-p|--per-cpu] [-s|--cpuid-stats] [-T|--timings]\n"
+                    "             [-t|--tsc] [-V|--virt] [-w|--watch interval[,count]] [-X|--xsave] [-x|--c2c]\n"
+                    "             [-S|--bench-startup runs]\n"
+                    "             [-d|--dump file] [-r|--replay file] [-b|--batch path] [-j|--jobs n]\n"
+                    "             [-c|--check flag[,flag...][:flag[,flag...]...]]\n");
+    /* not 1, which --check reserves for unsupported flags */
+    exit(2);
+}
+
+/* Returns one past the highest CPU described */
+static int get_cpu_isolation(cpu_isolation *cpus, int max, char *smt, size_t len, percpu_info *table, int cpu_num)
+{
+    int i = 0, j = 0, n = 0;
+#ifdef __linux__
+    char path[PATH_MAX], buf[CPU_LIST_LEN];
+    unsigned char present[AFFINITY_MAX_CPUS], online[AFFINITY_MAX_CPUS], isolated[AFFINITY_MAX_CPUS];
+    unsigned char nohz_full[AFFINITY_MAX_CPUS], rcu_nocbs[AFFINITY_MAX_CPUS];
+    int has_isolated = 0, has_nohz_full = 0, has_rcu_nocbs = 0;
+
+    (void)table;
+    max = MIN(max, AFFINITY_MAX_CPUS);
+    if (read_cpu_set("/sys/devices/system/cpu/present", NULL, present, max) == -1)
+    {
+        for (i = 0; (i < cpu_num) && (i < max); i++)
+        {
+            present[i] = 1;
+        }
+    }
+    if (read_cpu_set("/sys/devices/system/cpu/online", NULL, online, max) == -1)
+    {
+        memcpy(online, present, max);
+    }
+    has_isolated = (read_cpu_set("/sys/devices/system/cpu/isolated", "isolcpus", isolated, max) == 0);
+    has_nohz_full = (read_cpu_set("/sys/devices/system/cpu/nohz_full", "nohz_full", nohz_full, max) == 0);
+    has_rcu_nocbs = (read_cpu_set(NULL, "rcu_nocbs", rcu_nocbs, max) == 0);
+
+    for (i = 0; i < max; i++)
+    {
+        if (!present[i])
+        {
+            continue;
+        }
+        n = i + 1;
+        cpus[i].present = 1;
+        cpus[i].online = online[i];
+        cpus[i].isolated = has_isolated ? isolated[i] : -1;
+        cpus[i].nohz_full = has_nohz_full ? nohz_full[i] : -1;
+        /* the kernel offloads the callbacks of nohz_full CPUs too */
+        cpus[i].rcu_nocbs = (has_rcu_nocbs || (has_nohz_full && nohz_full[i])) ?
+                (rcu_nocbs[i] || (has_nohz_full && nohz_full[i])) : -1;
+        cpus[i].core = -1;
+        /* an offline CPU has no topology directory */
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", i);
+        if (online[i] && (read_small_file(path, buf, sizeof(buf)) > 0) && isdigit((unsigned char)buf[0]))
+        {
+            cpus[i].core = (int)strtol(buf, NULL, 10);
+        }
+    }
+
+    if (read_small_file("/sys/devices/system/cpu/smt/control", smt, len) > 0)
+    {
+        smt[strcspn(smt, "\n")] = '\0';
+    }
+    else
+    {
+        snprintf(smt, len, "unknown");
+    }
+#else
+    int value = 0;
+    size_t value_len = sizeof(value);
+#ifdef __OpenBSD__
+    int mib[2] = {CTL_HW, HW_SMT};
+#endif
+
+    /* the BSDs have no isolcpus, nohz_full or rcu_nocbs, and can't name offline CPUs */
+    for (i = 0; i < cpu_num; i++)
+    {
+        int cpu = table ? table[i].cpu : i;
+
+        if (cpu >= max)
+        {
+            continue;
+        }
+        n = MAX(n, cpu + 1);
+        cpus[cpu].present = 1;
+        cpus[cpu].online = cpus[cpu].isolated = cpus[cpu].nohz_full = cpus[cpu].rcu_nocbs = -1;
+        cpus[cpu].core = -1;
+        if (!table || !table[i].valid)
+        {
+            continue;
+        }
+        /* the lowest CPU ID of the core */
+        for (j = 0; j < cpu_num; j++)
+        {
+            if (table[j].valid && (table[j].package == table[i].package) && (table[j].die == table[i].die) &&
+                    (table[j].module == table[i].module) && (table[j].core == table[i].core) &&
+                    ((cpus[cpu].core == -1) || (table[j].cpu < cpus[cpu].core)))
+            {
+                cpus[cpu].core = table[j].cpu;
+            }
+        }
+    }
+
+#if defined(__OpenBSD__)
+    if (sysctl(mib, ARRAY_LEN(mib), &value, &value_len, NULL, 0) == 0)
+#elif defined(__FreeBSD__)
+    if (sysctlbyname("machdep.hyperthreading_allowed", &value, &value_len, NULL, 0) == 0)
+#else
+    if (0)
+#endif
+    {
+        snprintf(smt, len, "%s", value ? "on" : "off");
+    }
+    else
+    {
+        snprintf(smt, len, "unknown");
+    }
+#endif
+    (void)j;
+    return n;
+}
+
+static void print_isolation(percpu_info *table, int cpu_num)
+{
+    static const char *states[] = {"-", "no", "yes"};
+    cpu_isolation *cpus = calloc(AFFINITY_MAX_CPUS, sizeof(*cpus));
+    int i = 0, j = 0, k = 0, n = 0, siblings[AFFINITY_MAX_CPUS];
+    char smt[32], list[CPU_LIST_LEN];
+
+    if (!cpus)
+    {
+        err(1, "calloc");
+    }
+    n = get_cpu_isolation(cpus, AFFINITY_MAX_CPUS, smt, sizeof(smt), table, cpu_num);
+
+    printf("%-24s %s\n", "SMT control:", smt);
+    printf("%-4s %-7s %-9s %-10s %-10s %s\n", "CPU", "Online", "Isolated", "Nohz_full", "Rcu_nocbs", "Siblings");
+    for (i = 0; i < n; i++)
+    {
+        if (!cpus[i].present)
+        {
+            continue;
+        }
+        for (j = 0, k = 0; j < n; j++)
+        {
+            if ((cpus[i].core != -1) && (cpus[j].core == cpus[i].core))
+            {
+                siblings[k++] = j;
+            }
+        }
+        if (k)
+        {
+            format_cpu_list(siblings, k, list, sizeof(list));
+        }
+        else
+        {
+            snprintf(list, sizeof(list), "-");
+        }
+        printf("%-4d %-7s %-9s %-10s %-10s %s\n", i, states[cpus[i].online + 1], states[cpus[i].isolated + 1],
+                states[cpus[i].nohz_full + 1], states[cpus[i].rcu_nocbs + 1], list);
+    }
+
+    /* a sibling shares the core's execution units and caches, so isolating half a core isolates nothing */
+    for (i = 0; i < n; i++)
+    {
+        if (!cpus[i].present)
+        {
+            continue;
+        }
+        if ((cpus[i].isolated == 1) && !cpus[i].online)
+        {
+            printf("Mismatch: CPU %d is isolated but offline\n", i);
+        }
+        if ((cpus[i].nohz_full == 1) && !cpus[i].isolated)
+        {
+            printf("Mismatch: CPU %d is nohz_full but not isolated\n", i);
+        }
+        for (j = 0; (cpus[i].core != -1) && (j < n); j++)
+        {
+            if ((j == i) || (cpus[j].core != cpus[i].core) || !cpus[j].online)
+            {
+                continue;
+            }
+            if ((cpus[i].isolated == 1) && !cpus[j].isolated)
+            {
+                printf("Mismatch: CPU %d is isolated but its SMT sibling CPU %d is not\n", i, j);
+            }
+            if ((cpus[i].nohz_full == 1) && !cpus[j].nohz_full)
+            {
+                printf("Mismatch: CPU %d is nohz_full but its SMT sibling CPU %d is not\n", i, j);
+            }
+        }
+    }
+    free(cpus);
+    return;
+}
+
+/* Returns the number of nodes, -1 if the platform doesn't describe them */
+static int get_numa_nodes(numa_node *nodes, int max)
+{
+    int i = 0, j = 0, n = 0;
+    char *p = NULL, *end = NULL;
+#ifdef __linux__
+    char path[PATH_MAX], buf[CPU_LIST_LEN];
+    unsigned char online[NUMA_MAX_NODES];
+
+    if (read_cpu_set("/sys/devices/system/node/online", NULL, online, NUMA_MAX_NODES) == -1)
+    {
+        return -1;
+    }
+    for (i = 0; (i < NUMA_MAX_NODES) && (n < max); i++)
+    {
+        numa_node *node = &nodes[n];
+
+        if (!online[i])
+        {
+            continue;
+        }
+        memset(node, 0, sizeof(*node));
+        node->id = i;
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", i);
+        read_cpu_set(path, NULL, node->cpus, AFFINITY_MAX_CPUS);
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/meminfo", i);
+        if (read_small_file(path, buf, sizeof(buf)) > 0)
+        {
+            /* "Node 0 MemTotal:       65536000 kB" */
+            if ((p = strstr(buf, "MemTotal:")))
+            {
+                node->mem_total = strtoull(p + strlen("MemTotal:"), NULL, 10) * 1024;
+            }
+            if ((p = strstr(buf, "MemFree:")))
+            {
+                node->mem_free = strtoull(p + strlen("MemFree:"), NULL, 10) * 1024;
+            }
+        }
+        /* one distance per online node, in node order */
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/distance", i);
+        if (read_small_file(path, buf, sizeof(buf)) > 0)
+        {
+            for (p = buf, j = 0; j < NUMA_MAX_NODES; p = end, j++)
+            {
+                node->distance[j] = (int)strtol(p, &end, 10);
+                if (end == p)
+                {
+                    node->distance[j] = 0;
+                    break;
+                }
+            }
+        }
+        n++;
+    }
+#elif defined(__FreeBSD__)
+    char name[64], *buf = NULL;
+    size_t len = sizeof(n);
+    u_int pages = 0;
+    cpuset_t set;
+
+    if ((sysctlbyname("vm.ndomains", &n, &len, NULL, 0) == -1) || (n <= 0))
+    {
+        return -1;
+    }
+    n = MIN(n, max);
+    for (i = 0; i < n; i++)
+    {
+        numa_node *node = &nodes[i];
+
+        memset(node, 0, sizeof(*node));
+        node->id = i;
+#ifdef CPU_WHICH_DOMAIN
+        CPU_ZERO(&set);
+        if (cpuset_getaffinity(CPU_LEVEL_WHICH, CPU_WHICH_DOMAIN, i, sizeof(set), &set) == 0)
+        {
+            for (j = 0; (j < CPU_SETSIZE) && (j < AFFINITY_MAX_CPUS); j++)
+            {
+                node->cpus[j] = CPU_ISSET(j, &set) ? 1 : 0;
+            }
+        }
+#else
+        (void)set;
+#endif
+        len = sizeof(pages);
+        snprintf(name, sizeof(name), "vm.domain.%d.stats.page_count", i);
+        if (sysctlbyname(name, &pages, &len, NULL, 0) == 0)
+        {
+            node->mem_total = (uint64_t)pages * getpagesize();
+        }
+        len = sizeof(pages);
+        snprintf(name, sizeof(name), "vm.domain.%d.stats.free_count", i);
+        if (sysctlbyname(name, &pages, &len, NULL, 0) == 0)
+        {
+            node->mem_free = (uint64_t)pages * getpagesize();
+        }
+    }
+    /* vm.phys_locality is the SLIT as text, one row per line */
+    if ((sysctlbyname("vm.phys_locality", NULL, &len, NULL, 0) == 0) && (buf = malloc(len + 1)))
+    {
+        if (sysctlbyname("vm.phys_locality", buf, &len, NULL, 0) == 0)
+        {
+            buf[len] = '\0';
+            for (p = buf, i = 0; i < n * n; p = end, i++)
+            {
+                int distance = (int)strtol(p, &end, 10);
+
+                if (end == p)
+                {
+                    break;
+                }
+                nodes[i / n].distance[i % n] = distance;
+            }
+        }
+        free(buf);
+    }
+#else
+    (void)nodes;
+    (void)max;
+    (void)i;
+    (void)j;
+    (void)p;
+    (void)end;
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+    for (i = 0; i < n; i++)
+    {
+        for (j = 0; j < AFFINITY_MAX_CPUS; j++)
+        {
+            nodes[i].cpu_num += nodes[i].cpus[j];
+        }
+    }
+    return n;
+}
+
+/* Sort the keys and drop duplicates in place, ids gets their low 32 bits */
+static int unique_ids(uint64_t *keys, int key_num, int *ids)
+{
+    int i = 0, n = 0;
+
+    qsort(keys, key_num, sizeof(*keys), compare_uint64);
+    for (i = 0; i < key_num; i++)
+    {
+        if (!n || (keys[i] != keys[n - 1]))
+        {
+            keys[n] = keys[i];
+            ids[n++] = (int)(uint32_t)keys[i];
+        }
+    }
+    return n;
+}
+
+/*
+ * The sockets and L3 instances are the ones --extended and --cache-groups
+ * report, so a node can be matched to both. Nodes sharing an L3 show up
+ * with sub-NUMA clustering or NPS modes that split a socket.
+ */
+static void print_numa_info(percpu_info *table, int cpu_num, x86_cpu_info *x86_info)
+{
+    int i = 0, j = 0, k = 0, n = 0, m = 0, shift = -1;
+    int ids[AFFINITY_MAX_CPUS];
+    uint64_t keys[AFFINITY_MAX_CPUS];
+    char list[CPU_LIST_LEN], sockets[CPU_LIST_LEN], l3[CPU_LIST_LEN];
+    numa_node *nodes = calloc(NUMA_MAX_NODES, sizeof(*nodes));
+
+    if (!nodes)
+    {
+        err(1, "calloc");
+    }
+    if ((n = get_numa_nodes(nodes, NUMA_MAX_NODES)) <= 0)
+    {
+        printf("%-24s %s\n", "NUMA node(s):", "not available");
+        free(nodes);
+        return;
+    }
+
+    /* the last level cache, its instance is the APIC ID above the sharing bits */
+    for (i = 0; i < x86_info->cache_num; i++)
+    {
+        if ((x86_info->caches[i].level == 3) && x86_info->caches[i].sharing)
+        {
+            shift = ceil_log2(x86_info->caches[i].sharing);
+        }
+    }
+
+    printf("%-5s %-10s %-10s %-8s %-8s %s\n", "Node", "Total_MB", "Free_MB", "Sockets", "L3", "CPUs");
+    for (i = 0; i < n; i++)
+    {
+        const numa_node *node = &nodes[i];
+
+        for (j = 0, k = 0; j < AFFINITY_MAX_CPUS; j++)
+        {
+            if (node->cpus[j])
+            {
+                ids[k++] = j;
+            }
+        }
+        if (k)
+        {
+            format_cpu_list(ids, k, list, sizeof(list));
+        }
+        else
+        {
+            snprintf(list, sizeof(list), "-"); /* memory only, e.g. CXL or HBM */
+        }
+
+        snprintf(sockets, sizeof(sockets), "-");
+        snprintf(l3, sizeof(l3), "-");
+        if (table)
+        {
+            for (j = 0, k = 0; j < cpu_num; j++)
+            {
+                if (table[j].valid && (table[j].cpu < AFFINITY_MAX_CPUS) && node->cpus[table[j].cpu])
+                {
+                    keys[k++] = table[j].package;
+                }
+            }
+            if ((m = unique_ids(keys, k, ids)))
+            {
+                format_cpu_list(ids, m, sockets, sizeof(sockets));
+            }
+            for (j = 0, k = 0; (shift >= 0) && (j < cpu_num); j++)
+            {
+                if (table[j].valid && (table[j].cpu < AFFINITY_MAX_CPUS) && node->cpus[table[j].cpu])
+                {
+                    keys[k++] = percpu_apic_id(&table[j], x86_info) >> shift;
+                }
+            }
+            if ((m = unique_ids(keys, k, ids)))
+            {
+                format_cpu_list(ids, m, l3, sizeof(l3));
+            }
+        }
+        printf("%-5d %-10llu %-10llu %-8s %-8s %s\n", node->id, (unsigned long long)(node->mem_total >> 20),
+                (unsigned long long)(node->mem_free >> 20), sockets, l3, list);
+    }
+
+    if (nodes[0].distance[0])
+    {
+        printf("\n%-5s", "SLIT");
+        for (j = 0; j < n; j++)
+        {
+            printf(" %-4d", nodes[j].id);
+        }
+        printf("\n");
+        for (i = 0; i < n; i++)
+        {
+            printf("%-5d", nodes[i].id);
+            for (j = 0; j < n; j++)
+            {
+                printf(" %-4d", nodes[i].distance[j]);
+            }
+            printf("\n");
+        }
+    }
+
+    if (!table || (shift < 0))
+    {
+        free(nodes);
+        return;
+    }
+    /* the L3 instance in the high bits, the node in the low ones */
+    for (j = 0, k = 0; j < cpu_num; j++)
+    {
+        for (i = 0; table[j].valid && (table[j].cpu < AFFINITY_MAX_CPUS) && (i < n); i++)
+        {
+            if (nodes[i].cpus[table[j].cpu])
+            {
+                keys[k++] = ((uint64_t)(percpu_apic_id(&table[j], x86_info) >> shift) << 32) | (uint32_t)nodes[i].id;
+                break;
+            }
+        }
+    }
+    m = unique_ids(keys, k, ids);
+    for (i = 0; i < m; i = j)
+    {
+        for (j = i + 1; (j < m) && ((keys[j] >> 32) == (keys[i] >> 32)); j++)
+            ;
+        if (j - i > 1)
+        {
+            format_cpu_list(ids + i, j - i, list, sizeof(list));
+            printf("L3 instance %u is shared by nodes %s\n", (uint32_t)(keys[i] >> 32), list);
+        }
+    }
+    free(nodes);
+    return;
+}
+
+/*
+ * A container sees the host's CPUs, so size thread pools from what this
+ * process may actually use: its affinity mask, the cgroup cpuset and the
+ * CFS bandwidth quota. Workers go one per physical core before any SMT
+ * sibling is used.
+ */
+static void print_parallelism(percpu_info *table, int cpu_num)
+{
+    int cpus[AFFINITY_MAX_CPUS], rank[AFFINITY_MAX_CPUS], pos[AFFINITY_MAX_CPUS];
+    int picked[AFFINITY_MAX_CPUS] = {0};
+    const percpu_info *info[AFFINITY_MAX_CPUS];
+    int i = 0, j = 0, k = 0, n = 0, r = 0, valid = 0, cores = 0, usable = 0, limit = 0, threads = 0, core_threads = 0;
+    char list[CPU_LIST_LEN];
+#ifdef __linux__
+    cgroup_cpu_limits limits;
+    int cpuset_num = 0;
+#endif
+
+    if ((n = get_affinity_cpus(cpus, AFFINITY_MAX_CPUS)) > 0)
+    {
+        format_cpu_list(cpus, n, list, sizeof(list));
+        printf("%-24s %d (%s)\n", "Affinity CPU(s):", n, list);
+    }
+    else
+    {
+        for (n = 0; (n < cpu_num) && (n < AFFINITY_MAX_CPUS); n++)
+        {
+            cpus[n] = n;
+        }
+        printf("%-24s %s\n", "Affinity CPU(s):", "not supported");
+    }
+    usable = limit = n;
+
+#ifdef __linux__
+    get_cgroup_limits(&limits);
+    if (!limits.version)
+    {
+        printf("%-24s %s\n", "Cgroup:", "none");
+    }
+    else
+    {
+        printf("%-24s v%d\n", "Cgroup:", limits.version);
+        limits.cpuset[strcspn(limits.cpuset, "\n")] = '\0';
+        if ((cpuset_num = count_cpu_list(limits.cpuset)) > 0)
+        {
+            printf("%-24s %d (%s)\n", "Cgroup cpuset:", cpuset_num, limits.cpuset);
+            usable = MIN(usable, cpuset_num);
+        }
+        if (limits.quota > 0)
+        {
+            printf("%-24s %.2f CPU(s) (%ld/%ld us)\n", "CFS quota:", (double)limits.quota / limits.period,
+                    limits.quota, limits.period);
+            /* rounding down would leave a fractional quota unused */
+            limit = (int)((limits.quota + limits.period - 1) / limits.period);
+        }
+        else
+        {
+            printf("%-24s %s\n", "CFS quota:", "none");
+        }
+    }
+#endif
+
+    threads = MAX(MIN(usable, limit), 1);
+    printf("%-24s %d\n", "Usable CPU(s):", usable);
+    printf("%-24s %d\n", "Worker threads:", threads);
+    if (!table)
+    {
+        return;
+    }
+
+    /* the sweep's rows are keyed by CPU ID, not by position */
+    for (i = 0; i < n; i++)
+    {
+        info[i] = NULL;
+        for (j = 0; (j < cpu_num) && !info[i]; j++)
+        {
+            if (table[j].valid && (table[j].cpu == cpus[i]))
+            {
+                info[i] = &table[j];
+            }
+        }
+    }
+
+    /* rank 0 is the first usable CPU of its core, rank 1 the next sibling and so on */
+    for (i = 0; i < n; i++)
+    {
+        const percpu_info *x = info[i];
+
+        rank[i] = -1;
+        if (!x)
+        {
+            continue;
+        }
+        rank[i] = 0;
+        for (j = 0; j < n; j++)
+        {
+            const percpu_info *y = info[j];
+
+            if (y && (y->package == x->package) && (y->die == x->die) &&
+                    (y->module == x->module) && (y->core == x->core) && (y->smt < x->smt))
+            {
+                rank[i]++;
+            }
+        }
+        cores += !rank[i];
+        valid++;
+    }
+    for (r = 0, k = 0; k < valid; r++)
+    {
+        for (i = 0; i < n; i++)
+        {
+            if (rank[i] == r)
+            {
+                pos[i] = k++;
+            }
+        }
+    }
+
+    core_threads = MAX(MIN(cores, threads), 1);
+    printf("%-24s %d\n", "Physical cores:", cores);
+    printf("%-24s %d\n", "Worker threads (no SMT):", core_threads);
+    for (i = 0, k = 0; i < n; i++)
+    {
+        if ((rank[i] >= 0) && (pos[i] < MIN(threads, valid)))
+        {
+            picked[k++] = cpus[i];
+        }
+    }
+    format_cpu_list(picked, k, list, sizeof(list));
+    printf("%-24s %s\n", "Worker CPU list:", list);
+    for (i = 0, k = 0; i < n; i++)
+    {
+        if ((rank[i] >= 0) && (pos[i] < core_threads))
+        {
+            picked[k++] = cpus[i];
+        }
+    }
+    format_cpu_list(picked, k, list, sizeof(list));
+    printf("%-24s %s\n", "Core CPU list:", list);
+    return;
+}
+
+static void print_cpu_info(gen_cpu_info *gen_info, x86_cpu_info *x86_info)
+{
+#if defined(__amd64__) || defined(__i386__)
+    int x86 = 1;
+#else /* a replayed x86 dump is decoded on any architecture */
+    int x86 = (x86_info->standard_mask != 0);
+#endif
+    char flags[X86_FLAGS_LEN];
+
+    printf("%-24s %s\n", "Architecture:", gen_info->arch);
+    printf("%-24s %s\n", "Byte Order:", gen_info->byte_order == 1234 ? "Little Endian" : "Big Endian");
+#if defined(__OpenBSD__) || defined(__linux__)
+    printf("%-24s %d\n", "Active CPU(s):", gen_info->active_cpu_num);
+    printf("%-24s %d\n", "Total CPU(s):", gen_info->total_cpu_num);
+#else /* Other BSDs */
+    printf("%-24s %d\n", "Total CPU(s):", gen_info->active_cpu_num);
+#endif
+    if (gen_info->possible_cpu_num > gen_info->total_cpu_num)
+    {
+        printf("%-24s %d\n", "Possible CPU(s):", gen_info->possible_cpu_num);
+    }
+    if (gen_info->numa_node_num)
+    {
+        printf("%-24s %d\n", "NUMA node(s):", gen_info->numa_node_num);
+    }
+
+    if (x86)
+    {
+        if (x86_info->threads_per_core)
+        {
+            printf("%-24s %d\n", "Thread(s) per core:", x86_info->threads_per_core);
+        }
+
+        if (x86_info->cores_per_socket)
+        {
+            printf("%-24s %d\n", "Core(s) per socket:", x86_info->cores_per_socket);
+        }
+
+        if (x86_info->sockets)
+        {
+            printf("%-24s %d\n", "Socket(s):", x86_info->sockets);
+        }
+        else if ((x86_info->threads_per_core) && (x86_info->cores_per_socket))
+        {
+#if defined(__OpenBSD__) || defined(__linux__)
+            int total_cpu_num = gen_info->total_cpu_num;
+#else /* Other BSDs */
+            int total_cpu_num = gen_info->active_cpu_num;
+#endif
+            printf("%-24s %d\n", "Socket(s):", total_cpu_num / ((x86_info->threads_per_core) * (x86_info->cores_per_socket)));
+        }
+
+        if (x86_cpu_support_standard_flag(x86_info->standard_mask, CPUID_STANDARD_0_MASK))
+        {
+            printf("%-24s %s\n", "Vendor:", x86_info->vendor);
+        }
+        else
+        {
+#ifdef __OpenBSD__
+            printf("%-24s %s\n", "Vendor:", gen_info->vendor);
+#endif
+        }
+
+        if (x86_cpu_support_standard_flag(x86_info->standard_mask, CPUID_STANDARD_1_MASK))
+        {
+            printf("%-24s %d\n", "CPU family:", x86_info->family);
+            printf("%-24s %d\n", "Model:", x86_info->model);
+        }
+        printf("%-24s %s\n", "Model name:", gen_info->model);
+        if (x86_cpu_support_standard_flag(x86_info->standard_mask, CPUID_STANDARD_1_MASK))
+        {   
+            printf("%-24s %d\n", "Stepping:", x86_info->stepping);
+        }
+
+#ifdef __OpenBSD__
+        printf("%-24s %d\n", "CPU MHz:", gen_info->speed);
+#endif
+
+        if (x86_info->l1d_cache[0])
+        {
+            printf("%-24s %s\n", "L1d cache:", x86_info->l1d_cache);
+        }
+        if (x86_info->l1i_cache[0])
+        {
+            printf("%-24s %s\n", "L1i cache:", x86_info->l1i_cache);
+        }
+        if (x86_info->l2_cache[0])
+        {
+            printf("%-24s %s\n", "L2 cache:", x86_info->l2_cache);
+        }
+        if (x86_info->l3_cache[0])
+        {
+            printf("%-24s %s\n", "L3 cache:", x86_info->l3_cache);
+        }
+
+        if (x86_info->isa_level == 1)
+        {
+            printf("%-24s %s\n", "ISA level:", "x86-64");
+        }
+        else if (x86_info->isa_level)
+        {
+            printf("%-24s x86-64-v%d\n", "ISA level:", x86_info->isa_level);
+        }
+        if (x86_info->xcr0_valid)
+        {
+            printf("%-24s 0x%llx\n", "XCR0:", (unsigned long long)x86_info->xcr0);
+        }
+
+        if (format_x86_flags(x86_info->features, flags, sizeof(flags)))
+        {
+            printf("%-24s %s\n", "Flags:", flags);
+        }
+        if (format_x86_flags(x86_info->disabled, flags, sizeof(flags)))
+        {
+            printf("%-24s %s\n", "OS-disabled flags:", flags);
+        }
+    }
+    else /* Other architectures */
+    {
+        printf("%-24s %s\n", "Model name:", gen_info->model);
+#ifdef __OpenBSD__
+        printf("%-24s %d\n", "CPU MHz:", gen_info->speed);
+#endif
+    }
+
+    return;
+}
+
+static void print_cache_info(x86_cpu_info *x86_info)
+{
+    int i = 0;
+    static const char *types[] = {"Null", "Data", "Instruction", "Unified"};
+
+    printf("%-6s %-12s %-8s %-12s %-5s %-5s %-5s %-8s %-7s %s\n",
+            "Cache", "Type", "Size", "Bytes", "Line", "Ways", "Parts", "Sets", "Shared", "Inclusive");
+    for (i = 0; i < x86_info->cache_num; i++)
+    {
+        const x86_cache *cache = &x86_info->caches[i];
+        char name[8], size[CACHE_SIZE_LEN], ways[8], sharing[8];
+
+        format_cache_name(cache, name, sizeof(name));
+        set_cache_size_bytes(size, cache->size, cache->size % (1024 * 1024) == 0);
+        if (cache->fully_associative)
+        {
+            snprintf(ways, sizeof(ways), "full");
+        }
+        else
+        {
+            snprintf(ways, sizeof(ways), "%u", cache->ways);
+        }
+        /* the legacy AMD leaves don't report sharing */
+        if (cache->sharing)
+        {
+            snprintf(sharing, sizeof(sharing), "%u", cache->sharing);
+        }
+        else
+        {
+            snprintf(sharing, sizeof(sharing), "-");
+        }
+        printf("%-6s %-12s %-8s %-12llu %-5u %-5s %-5u %-8u %-7s %s\n",
+                name, (cache->type < ARRAY_LEN(types)) ? types[cache->type] : "Unknown",
+                size, (unsigned long long)cache->size, cache->line_size, ways,
+                cache->partitions, cache->sets, sharing, cache->inclusive ? "yes" : "no");
+    }
+    return;
+}
+
+/*
+ * Every XSAVE state component the CPU supports, from leaf 0xD. User
+ * components are enabled through XCR0, supervisor ones through IA32_XSS,
+ * which only the kernel can read.
+ */
+static void print_xsave_info(const cpuid_table *table, const x86_cpu_info *x86_info)
+{
+    static const char *names[] = {
+        "x87", "SSE", "AVX", "MPX BNDREGS", "MPX BNDCSR", "AVX-512 opmask",
+        "AVX-512 ZMM_Hi256", "AVX-512 Hi16_ZMM", "PT", "PKRU", "PASID",
+        "CET user", "CET supervisor", "HDC", "UINTR", "LBR", "HWP",
+        "AMX XTILECFG", "AMX XTILEDATA", "APX",
+    };
+    static const int ids[] = {
+        X86_FEATURE_XSAVE, X86_FEATURE_XSAVEOPT, X86_FEATURE_XSAVEC,
+        X86_FEATURE_XGETBV1, X86_FEATURE_XSAVES, X86_FEATURE_XFD,
+    };
+    const uint32_t *regs = NULL, *regs1 = NULL;
+    uint64_t user = 0, supervisor = 0;
+    uint32_t compacted = XSAVE_LEGACY_SIZE + XSAVE_HEADER_SIZE;
+    char flags[X86_FLAGS_LEN];
+    int i = 0, n = 0;
+
+    regs = cpuid_table_regs(table, CPUID_STANDARD_D_MASK, 0);
+    if (!X86_HAS_FEATURE(x86_info, X86_FEATURE_XSAVE) || !regs)
+    {
+        printf("%-24s %s\n", "XSAVE:", "none");
+        return;
+    }
+
+    flags[0] = '\0';
+    for (i = 0; i < ARRAY_LEN(ids); i++)
+    {
+        if (X86_HAS_FEATURE(x86_info, ids[i]))
+        {
+            n += snprintf(flags + n, (n < sizeof(flags)) ? sizeof(flags) - n : 0, "%s%s", n ? " " : "",
+                    x86_features[ids[i]].name);
+        }
+    }
+    printf("%-24s %s\n", "XSAVE:", flags);
+
+    user = ((uint64_t)regs[CPUID_EDX] << 32) | regs[CPUID_EAX];
+    if ((regs1 = cpuid_table_regs(table, CPUID_STANDARD_D_MASK, 1)))
+    {
+        supervisor = ((uint64_t)regs1[CPUID_EDX] << 32) | regs1[CPUID_ECX];
+    }
+    printf("%-24s 0x%llx\n", "Supported XCR0:", (unsigned long long)user);
+    if (supervisor)
+    {
+        printf("%-24s 0x%llx\n", "Supported XSS:", (unsigned long long)supervisor);
+    }
+    if (x86_info->xcr0_valid)
+    {
+        printf("%-24s 0x%llx\n", "Enabled XCR0:", (unsigned long long)x86_info->xcr0);
+    }
+
+    printf("%-4s %-20s %-6s %-7s %-6s %-4s %-10s %s\n",
+            "Bit", "Component", "Size", "Offset", "Align", "XFD", "Kind", "Enabled");
+    for (i = 0; i < XSAVE_MAX_COMPONENTS; i++)
+    {
+        uint64_t bit = 1ULL << i;
+        uint32_t size = 0, offset = 0, ecx = 0;
+        char name[24], enabled[8];
+
+        if (!((user | supervisor) & bit))
+        {
+            continue;
+        }
+
+        /* x87 and SSE live in the fixed legacy area */
+        if (i == 0)
+        {
+            size = 160;
+        }
+        else if (i == 1)
+        {
+            size = 256;
+            offset = 160;
+        }
+        else if ((regs = cpuid_table_regs(table, CPUID_STANDARD_D_MASK, i)))
+        {
+            size = regs[CPUID_EAX];
+            offset = regs[CPUID_EBX];
+            ecx = regs[CPUID_ECX];
+        }
+        else
+        {
+            continue;
+        }
+
+        if (i < ARRAY_LEN(names))
+        {
+            snprintf(name, sizeof(name), "%s", names[i]);
+        }
+        else
+        {
+            snprintf(name, sizeof(name), "component %d", i);
+        }
+        if (supervisor & bit)
+        {
+            snprintf(enabled, sizeof(enabled), "-");
+        }
+        else if (x86_info->xcr0_valid)
+        {
+            snprintf(enabled, sizeof(enabled), "%s", (x86_info->xcr0 & bit) ? "yes" : "no");
+        }
+        else
+        {
+            snprintf(enabled, sizeof(enabled), "unknown");
+        }
+
+        /* the XSAVEC layout packs the enabled user components after the header */
+        if ((i >= 2) && !(supervisor & bit) && (!x86_info->xcr0_valid || (x86_info->xcr0 & bit)))
+        {
+            if (ecx & 2)
+            {
+                compacted = (compacted + 63) & ~63U;
+            }
+            compacted += size;
+        }
+
+        if (supervisor & bit)
+        {
+            printf("%-4d %-20s %-6u %-7s %-6s %-4s %-10s %s\n", i, name, size, "-",
+                    (ecx & 2) ? "64" : "-", (ecx & 4) ? "yes" : "no", "supervisor", enabled);
+        }
+        else
+        {
+            printf("%-4d %-20s %-6u %-7u %-6s %-4s %-10s %s\n", i, name, size, offset,
+                    (ecx & 2) ? "64" : "-", (ecx & 4) ? "yes" : "no", "user", enabled);
+        }
+    }
+
+    regs = cpuid_table_regs(table, CPUID_STANDARD_D_MASK, 0);
+    printf("%-24s %u bytes\n", "XSAVE area (enabled):", regs[CPUID_EBX]);
+    printf("%-24s %u bytes\n", "XSAVE area (all):", regs[CPUID_ECX]);
+    if (X86_HAS_FEATURE(x86_info, X86_FEATURE_XSAVEC))
+    {
+        printf("%-24s %u bytes\n", "XSAVEC area (enabled):", compacted);
+    }
+    /* subleaf 1 ebx covers XCR0 | IA32_XSS as the kernel set them */
+    if (regs1 && X86_HAS_FEATURE(x86_info, X86_FEATURE_XSAVES) && regs1[CPUID_EBX])
+    {
+        printf("%-24s %u bytes\n", "XSAVES area (enabled):", regs1[CPUID_EBX]);
+    }
+    return;
+}
+
+static void print_percpu_info(percpu_info *table, int cpu_num)
+{
+    int i = 0, j = 0, ref = -1, mismatch = 0;
+
+    printf("%-5s %-8s %-10s %-7s %-6s %-9s %-6s\n",
+            "CPU", "APICID", "X2APICID", "FAMILY", "MODEL", "STEPPING", "TYPE");
+    for (i = 0; i < cpu_num; i++)
+    {
+        percpu_info *info = &table[i];
+        unsigned int family = 0, model = 0;
+        const char *core_type = "-";
+
+        if (!info->valid)
+        {
+            printf("%-5d %-8s %-10s %-7s %-6s %-9s %-6s\n", info->cpu, "-", "-", "-", "-", "-", "-");
+            continue;
+        }
+
+        family = (info->signature >> 8) & 0xF;
+        model = (info->signature >> 4) & 0xF;
+        if ((family == 6) || (family == 15))
+        {
+            model |= (info->signature >> 12) & 0xF0;
+            if (family == 15)
+            {
+                family += (info->signature >> 20) & 0xFF;
+            }
+        }
+
+        switch ((info->hybrid_info >> 24) & 0xFF)
+        {
+            case 0x20:
+            {
+                core_type = "Atom";
+                break;
+            }
+            case 0x40:
+            {
+                core_type = "Core";
+                break;
+            }
+            default:
+            {
+                break;
+            }
+        }
+
+        printf("%-5d %-8u %-10u %-7u %-6u %-9u %-6s\n", info->cpu, info->apic_id, info->x2apic_id,
+                family, model, info->signature & 0xF, core_type);
+    }
+
+    /* Report every CPU that doesn't match the first one we could run on */
+    for (i = 0; i < cpu_num; i++)
+    {
+        if (!table[i].valid)
+        {
+            continue;
+        }
+        if (ref == -1)
+        {
+            ref = i;
+            continue;
+        }
+
+        if (table[i].signature != table[ref].signature)
+        {
+            printf("CPU %d: signature 0x%08x differs from CPU %d (0x%08x)\n",
+                    table[i].cpu, table[i].signature, table[ref].cpu, table[ref].signature);
+            mismatch = 1;
+        }
+        for (j = 0; j < PERCPU_FEATURE_WORDS; j++)
+        {
+            if (table[i].features[j] != table[ref].features[j])
+            {
+                printf("CPU %d: %s 0x%08x differs from CPU %d (0x%08x)\n", table[i].cpu,
+                        percpu_feature_regs[j], table[i].features[j], table[ref].cpu, table[ref].features[j]);
+                mismatch = 1;
+            }
+        }
+    }
+
+    if ((ref != -1) && !mismatch)
+    {
+        printf("%-24s %s\n", "Mismatches:", "none");
+    }
+    return;
+}
+
+static void print_topology(percpu_info *table, int cpu_num)
+{
+    int i = 0;
+
+    printf("%-5s %-7s %-5s %-7s %-5s %-5s %-10s\n", "CPU", "SOCKET", "DIE", "MODULE", "CORE", "SMT", "X2APICID");
+    for (i = 0; i < cpu_num; i++)
+    {
+        percpu_info *info = &table[i];
+
+        if (!info->valid)
+        {
+            printf("%-5d %-7s %-5s %-7s %-5s %-5s %-10s\n", info->cpu, "-", "-", "-", "-", "-", "-");
+            continue;
+        }
+        printf("%-5d %-7u %-5u %-7u %-5u %-5u %-10u\n", info->cpu, info->package, info->die,
+                info->module, info->core, info->smt, info->x2apic_id);
+    }
+    return;
+}
+
+/* Render sorted CPU numbers as a list of ranges, e.g. "0-3,8,10-11" */
+static int format_cpu_list(const int *cpus, int cpu_num, char *buf, size_t len)
+{
+    int i = 0, j = 0, n = 0;
+
+    buf[0] = '\0';
+    for (i = 0; i < cpu_num; i = j)
+    {
+        for (j = i + 1; (j < cpu_num) && (cpus[j] == cpus[j - 1] + 1); j++)
+            ;
+        if (j - i > 1)
+        {
+            n += snprintf(buf + n, (n < len) ? len - n : 0, "%s%d-%d", n ? "," : "", cpus[i], cpus[j - 1]);
+        }
+        else
+        {
+            n += snprintf(buf + n, (n < len) ? len - n : 0, "%s%d", n ? "," : "", cpus[i]);
+        }
+    }
+    return n;
+}
+
+/*
+ * CPUs share a cache instance when their APIC IDs agree above the bits
+ * covering its "maximum logical processors sharing" count.
+ */
+static void print_cache_groups(percpu_info *table, int cpu_num, x86_cpu_info *x86_info)
+{
+    int i = 0, j = 0, k = 0, n = 0;
+    uint64_t *keys = NULL;
+    int *cpus = NULL;
+    char name[8], list[CPU_LIST_LEN];
+
+    if ((cpu_num <= 0) || !(keys = calloc(cpu_num, sizeof(*keys))) || !(cpus = calloc(cpu_num, sizeof(*cpus))))
+    {
+        err(1, "calloc");
+    }
+
+    printf("%-6s %-10s %-6s %s\n", "Cache", "Instance", "CPUs", "List");
+    for (i = 0; i < x86_info->cache_num; i++)
+    {
+        const x86_cache *cache = &x86_info->caches[i];
+        int shift = ceil_log2(cache->sharing);
+
+        /* the legacy AMD leaves don't report sharing */
+        if (!cache->sharing)
+        {
+            continue;
+        }
+        format_cache_name(cache, name, sizeof(name));
+
+        /* the instance in the high bits, the CPU in the low ones */
+        for (j = 0, n = 0; j < cpu_num; j++)
+        {
+            if (table[j].valid)
+            {
+                keys[n++] = ((uint64_t)(percpu_apic_id(&table[j], x86_info) >> shift) << 32) | (uint32_t)table[j].cpu;
+            }
+        }
+        qsort(keys, n, sizeof(*keys), compare_uint64);
+
+        for (j = 0; j < n; j = k)
+        {
+            for (k = j; (k < n) && ((keys[k] >> 32) == (keys[j] >> 32)); k++)
+            {
+                cpus[k - j] = (int)(keys[k] & 0xFFFFFFFF);
+            }
+            format_cpu_list(cpus, k - j, list, sizeof(list));
+            printf("%-6s %-10u %-6d %s\n", name, (uint32_t)(keys[j] >> 32), k - j, list);
+        }
+    }
+
+    free(cpus);
+    free(keys);
+    return;
+}
+
+static void print_cpuid_stats(cpuid_table *table)
+{
+    printf("%-24s %u\n", "CPUID instructions:", table->exec_count);
+    printf("%-24s %d\n", "CPUID leaves captured:", table->count);
+    printf("%-24s %.1f us\n", "CPUID time:", table->exec_nsec / 1000.0);
+    return;
+}
+
+int main(int argc, char **argv) 
+{
+    uint64_t wall_start = now_nsec(), cpu_start = cpu_nsec();
+    int ch = 0, per_cpu = 0, cpuid_stats = 0, use_snapshot = 1, caches = 0, extended = 0;
+    int cache_groups = 0, bench_memory = 0, bench_simd = 0, c2c = 0, tsc = 0, turbo_curve = 0, xsave = 0, virt = 0;
+    int timings_flag = 0, startup_runs = 0, parallelism = 0, isolation = 0, numa = 0, bench_numa = 0, id = -1;
+    int cpu_ids[AFFINITY_MAX_CPUS], cpu_num = 0;
+    double watch_interval = 0;
+    long watch_count = 0;
+    char *end = NULL;
+    percpu_info *table = NULL;
+    const cpu_snapshot *snapshot = NULL;
+    int jobs = 0;
+    const char *dump_path = NULL, *replay_path = NULL, *batch_path = NULL, *check_spec = NULL, *self = argv[0];
+
+    struct option longopts[] = {
+        {"batch", required_argument, NULL, 'b'},
+        {"bench-memory", no_argument, NULL, 'M'},
+        {"bench-numa", no_argument, NULL, 'm'},
+        {"bench-simd", no_argument, NULL, 'B'},
+        {"c2c", no_argument, NULL, 'x'},
+        {"caches", no_argument, NULL, 'C'},
+        {"check", required_argument, NULL, 'c'},
+        {"dump", required_argument, NULL, 'd'},
+        {"extended", no_argument, NULL, 'e'},
+        {"freq-curve", no_argument, NULL, 'F'},
+        {"cache-groups", no_argument, NULL, 'g'},
+        {"help", no_argument, NULL, 'h'},
+        {"isolation", no_argument, NULL, 'I'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"no-snapshot", no_argument, NULL, 'n'},
+        {"numa", no_argument, NULL, 'N'},
+        {"parallelism", no_argument, NULL, 'P'},
+        {"per-cpu", no_argument, NULL, 'p'},
+        {"bench-startup", required_argument, NULL, 'S'},
+        {"timings", no_argument, NULL, 'T'},
+        {"replay", required_argument, NULL, 'r'},
+        {"cpuid-stats", no_argument, NULL, 's'},
+        {"tsc", no_argument, NULL, 't'},
+        {"virt", no_argument, NULL, 'V'},
+        {"watch", required_argument, NULL, 'w'},
+        {"xsave", no_argument, NULL, 'X'},
+        {NULL, 0, NULL, 0}
+    };
+
+    while ((ch = getopt_long(argc, argv, "Bb:Cc:d:eFghIj:MmNnPpr:S:stTVw:Xx", longopts, NULL)) != -1) 
+    {
+        switch (ch)
+        {
+            case 'B':
+            {
+                bench_simd = 1;
+                break;
+            }
+            case 'b':
+            {
+                batch_path = optarg;
+                break;
+            }
+            case 'C':
+            {
+                caches = 1;
+                break;
+            }
+            case 'c':
+            {
+                check_spec = optarg;
+                break;
+            }
+            case 'j':
+            {
+                jobs = (int)strtol(optarg, &end, 10);
+                if ((jobs <= 0) || *end)
+                {
+                    usage();
+                }
+                break;
+            }
+            case 'd':
+            {
+                dump_path = optarg;
+                break;
+            }
+            case 'e':
+            {
+                extended = 1;
+                break;
+            }
+            case 'F':
+            {
+                turbo_curve = 1;
+                break;
+            }
+            case 'g':
+            {
+                cache_groups = 1;
+                break;
+            }
+            case 'I':
+            {
+                isolation = 1;
+                break;
+            }
+            case 'M':
+            {
+                bench_memory = 1;
+                break;
+            }
+            case 'm':
+            {
+                bench_numa = 1;
+                break;
+            }
+            case 't':
+            {
+                tsc = 1;
+                break;
+            }
+            case 'V':
+            {
+                virt = 1;
+                break;
+            }
+            case 'w':
+            {
+                watch_interval = strtod(optarg, &end);
+                if (*end == ',')
+                {
+                    watch_count = strtol(end + 1, &end, 10);
+                }
+                if ((watch_interval <= 0) || (watch_count < 0) || *end)
+                {
+                    usage();
+                }
+                break;
+            }
+            case 'X':
+            {
+                xsave = 1;
+                break;
+            }
+            case 'x':
+            {
+                c2c = 1;
+                break;
+            }
+            case 'r':
+            {
+                replay_path = optarg;
+                break;
+            }
+            case 'N':
+            {
+                numa = 1;
+                break;
+            }
+            case 'n':
+            {
+                use_snapshot = 0;
+                break;
+            }
+            case 's':
+            {
+                cpuid_stats = 1;
+                break;
+            }
+            case 'S':
+            {
+                startup_runs = (int)strtol(optarg, &end, 10);
+                if ((startup_runs <= 0) || *end)
+                {
+                    usage();
+                }
+                break;
+            }
+            case 'T':
+            {
+                timings_flag = 1;
+                break;
+            }
+            case 'P':
+            {
+                parallelism = 1;
+                break;
+            }
+            case 'p':
+            {
+                per_cpu = 1;
+                break;
+            }
+            case 'h':
+            case '?':
+            default:
+            {
+                usage();
+            }
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc)
+    {
+        usage();
+    }
+
+    /* A check only executes the leaves it needs and skips the sysctl walk */
+    if (check_spec)
+    {
+        return check_x86_features(check_spec);
+    }
+
+    if (batch_path)
+    {
+        if (!jobs)
+        {
+            jobs = MAX((int)sysconf(_SC_NPROCESSORS_ONLN), 1);
+        }
+        run_batch(batch_path, jobs);
+        return 0;
+    }
+
+    if (startup_runs)
+    {
+        run_startup_bench(self, startup_runs);
+        return 0;
+    }
+
+    /* only the single-threaded paths below are timed */
+    timing_enabled = timings_flag;
+
+    if (replay_path)
+    {
+        int replay_id = timing_begin("replay", 0);
+
+        id = timing_begin("dump load", 1);
+        if (load_cpu_dump(replay_path, &cpuid_raw) == -1)
+        {
+            err(1, "%s", replay_path);
+        }
+        timing_end(id);
+        id = timing_begin("decode", 1);
+        decode_x86_cpu_info(&cpuid_raw, &x86_info);
+        timing_end(id);
+        timing_end(replay_id);
+        id = timing_begin("print", 0);
+        print_cpu_info(&gen_info, &x86_info);
+        if (caches)
+        {
+            print_cache_info(&x86_info);
+        }
+        if (xsave)
+        {
+            print_xsave_info(&cpuid_raw, &x86_info);
+        }
+        if (tsc)
+        {
+            print_tsc_info(&cpuid_raw, &x86_info, NULL, 0, 0);
+        }
+        if (virt)
+        {
+            print_virt_info(&cpuid_raw, &x86_info, 0);
+        }
+        if (cpuid_stats)
+        {
+            print_cpuid_stats(&cpuid_raw);
+        }
+        timing_end(id);
+        if (timings_flag)
+        {
+            print_timings(wall_start, cpu_start);
+        }
+        return 0;
+    }
+
+    /* The statistics describe this run's probe, so they always probe afresh */
+    if (use_snapshot && !per_cpu && !extended && !cache_groups && !bench_memory && !bench_numa && !bench_simd && !c2c && !tsc && !virt && !parallelism && !isolation && !numa && !watch_interval && !turbo_curve && !cpuid_stats && !dump_path)
+    {
+        id = timing_begin("snapshot load", 0);
+        snapshot = load_snapshot();
+        timing_end(id);
+    }
+    if (snapshot)
+    {
+        id = timing_begin("print", 0);
+        print_cpu_info((gen_cpu_info *)&snapshot->gen_info, (x86_cpu_info *)&snapshot->x86_info);
+        if (caches)
+        {
+            print_cache_info((x86_cpu_info *)&snapshot->x86_info);
+        }
+        if (xsave)
+        {
+            print_xsave_info(&snapshot->cpuid_raw, &snapshot->x86_info);
+        }
+        timing_end(id);
+        if (timings_flag)
+        {
+            print_timings(wall_start, cpu_start);
+        }
+        return 0;
+    }
+
+    id = timing_begin(platform.name, 0);
+    if (platform.get_gen_info(&gen_info) == -1)
+    {
+        err(1, "%s", platform.name);
+    }
+    timing_end(id);
+
+#if defined(__amd64__) || defined(__i386__)
+    id = timing_begin("get_x86_cpu_info", 0);
+    get_x86_cpu_info(&x86_info);
+    timing_end(id);
+    if (!gen_info.model[0])
+    {
+        decode_x86_brand_string(&cpuid_raw, gen_info.model, sizeof(gen_info.model));
+    }
+#endif
+
+    cpu_num = get_cpu_ids(cpu_ids, AFFINITY_MAX_CPUS, gen_info.active_cpu_num);
+
+    if (dump_path)
+    {
+        if (dump_cpu_info(dump_path, &cpuid_raw) == -1)
+        {
+            err(1, "%s", dump_path);
+        }
+        return 0;
+    }
+
+    if (bench_memory)
+    {
+        run_memory_bench(cpu_ids, cpu_num, &x86_info, jobs ? jobs : cpu_num);
+        return 0;
+    }
+
+    if (bench_numa)
+    {
+        run_numa_bench(&x86_info);
+        return 0;
+    }
+
+    if (bench_simd)
+    {
+#if defined(__amd64__) || defined(__i386__)
+        run_simd_bench(cpu_ids, cpu_num, &x86_info);
+        return 0;
+#else
+        errx(1, "the SIMD benchmark needs an x86 CPU");
+#endif
+    }
+
+    if (turbo_curve)
+    {
+#if defined(__amd64__) || defined(__i386__)
+        run_turbo_curve(cpu_ids, cpu_num, &x86_info);
+        return 0;
+#else
+        errx(1, "the frequency curve needs an x86 CPU");
+#endif
+    }
+
+    if (watch_interval)
+    {
+#if defined(__amd64__) || defined(__i386__)
+        run_watch(cpu_ids, cpu_num, &x86_info, watch_interval, watch_count);
+        return 0;
+#else
+        errx(1, "frequency monitoring needs an x86 CPU");
+#endif
+    }
+
+    if (c2c)
+    {
+        run_c2c(cpu_ids, cpu_num, &x86_info);
+        return 0;
+    }
+
+    if (isolation)
+    {
+#ifdef __linux__
+        /* sysfs names the siblings, so no thread wakes the isolated CPUs */
+        print_isolation(NULL, gen_info.total_cpu_num);
+#else
+        table = collect_percpu_info(cpu_ids, cpu_num, &x86_info);
+        print_isolation(table, cpu_num);
+        free(table);
+#endif
+        return 0;
+    }
+
+    if (per_cpu || extended || cache_groups)
+    {
+        if (!(table = collect_percpu_info(cpu_ids, cpu_num, &x86_info)))
+        {
+            errx(1, "per-CPU mode isn't supported on this platform");
+        }
+        if (per_cpu)
+        {
+            print_percpu_info(table, cpu_num);
+        }
+        if (extended)
+        {
+            print_topology(table, cpu_num);
+        }
+        if (cache_groups)
+        {
+            print_cache_groups(table, cpu_num, &x86_info);
+        }
+        free(table);
+        return 0;
+    }
+
+#if defined(__amd64__) || defined(__i386__)
+    /* count the sockets where the CPUs really are, the snapshot keeps the result */
+    if (platform.get_topology)
+    {
+        id = timing_begin("socket count", 0);
+        platform.get_topology(&x86_info);
+        timing_end(id);
+    }
+    if (parallelism || numa)
+    {
+        id = timing_begin("per-CPU sweep", 0);
+        table = collect_percpu_info(cpu_ids, cpu_num, &x86_info);
+        timing_end(id);
+    }
+#endif
+
+    if (use_snapshot)
+    {
+        id = timing_begin("snapshot save", 0);
+        save_snapshot(&gen_info, &x86_info, &cpuid_raw);
+        timing_end(id);
+    }
+
+    id = timing_begin("print", 0);
+    print_cpu_info(&gen_info, &x86_info);
+    if (caches)
+    {
+        print_cache_info(&x86_info);
+    }
+    if (xsave)
+    {
+        print_xsave_info(&cpuid_raw, &x86_info);
+    }
+    if (tsc)
+    {
+        /* the rate and skew are measured, so this only works live */
+        print_tsc_info(&cpuid_raw, &x86_info, cpu_ids, cpu_num, 1);
+    }
+    if (virt)
+    {
+        /* the costs are measured, so like the TSC rate this only works live */
+        print_virt_info(&cpuid_raw, &x86_info, 1);
+    }
+    if (parallelism)
+    {
+        /* the limits belong to this process, so they are read live as well */
+        print_parallelism(table, cpu_num);
+    }
+    if (numa)
+    {
+        /* free memory changes by the second, so this is live too */
+        print_numa_info(table, cpu_num, &x86_info);
+    }
+    if (cpuid_stats)
+    {
+        print_cpuid_stats(&cpuid_raw);
+    }
+    timing_end(id);
+    free(table);
+    if (timings_flag)
+    {
+        print_timings(wall_start, cpu_start);
+    }
 
     return 0;
 }